@@ -0,0 +1,31 @@
+#include <cstring>
+#include "Arena.h"
+
+void Arena::reserve(std::size_t bytes) {
+    // spare line so the start can be aligned whatever new[] returns
+    memory = std::make_unique<std::byte[]>(bytes + ARENA_ALIGN);
+    std::memset(memory.get(), 0, bytes + ARENA_ALIGN);
+    const std::uintptr_t at = reinterpret_cast<std::uintptr_t>(memory.get());
+    base = memory.get() + (arena_round(at) - at);
+    capacity = bytes;
+    used = 0;
+}
+
+void* Arena::carve(std::size_t bytes) {
+    bytes = arena_round(bytes);
+    if (used + bytes > capacity)
+        return nullptr;
+    void* block = base + used;
+    used += bytes;
+    return block;
+}
+
+bool BlockArena::allocate(Arena& arena, std::size_t bytes) {
+    bytes = arena_round(bytes);
+    base = static_cast<std::byte*>(arena.carve(bytes));
+    capacity = base ? bytes : 0;
+    top = 0;
+    peak.store(0, std::memory_order_relaxed);
+    misses.store(0, std::memory_order_relaxed);
+    return base != nullptr;
+}
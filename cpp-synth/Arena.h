@@ -0,0 +1,139 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+
+// alignment of everything carved, a cache line
+constexpr std::size_t ARENA_ALIGN = 64;
+
+constexpr std::size_t arena_round(std::size_t bytes) { return (bytes + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1); }
+
+// One allocation made while the synth is set up and carved into everything the audio thread keeps.
+// Nothing carved is given back on its own, reserve() drops it all and starts over.
+class Arena
+{
+private:
+    std::unique_ptr<std::byte[]> memory;
+    std::byte*  base     = nullptr;
+    std::size_t capacity = 0;
+    std::size_t used     = 0;
+public:
+    // room for bytes, zeroed so the pages are mapped before the audio thread touches them;
+    // never while the audio thread runs
+    void        reserve(std::size_t bytes);
+    // nullptr once the reserve is used up
+    void*       carve(std::size_t bytes);
+    // count default constructed T, which must need no destructor
+    template <typename T>
+    T*          carve_array(std::size_t count)
+    {
+        static_assert(std::is_trivially_destructible_v<T>, "arena objects are never destroyed");
+        static_assert(alignof(T) <= ARENA_ALIGN, "arena alignment is a cache line");
+        T* items = static_cast<T*>(carve(count * sizeof(T)));
+        if (items)
+            for (std::size_t i = 0; i < count; i++)
+                new (items + i) T{};
+        return items;
+    }
+    std::size_t size() const  { return capacity; }
+    std::size_t bytes_used() const { return used; }
+};
+
+// A fixed number of T carved from an arena, handed out and back in constant time through a stack of
+// free slots. Only the audio thread acquires and releases; the counts can be read from any thread.
+template <typename T>
+class Pool
+{
+private:
+    T*             items      = nullptr;
+    std::uint32_t* free_slots = nullptr;
+    std::size_t    count      = 0;
+    std::size_t    free_top   = 0;
+    std::atomic<std::size_t> in_use{ 0 };
+    std::atomic<std::size_t> peak{ 0 };
+    std::atomic<std::size_t> misses{ 0 };
+public:
+    static constexpr std::size_t bytes(std::size_t count)
+    {
+        return arena_round(count * sizeof(T)) + arena_round(count * sizeof(std::uint32_t));
+    }
+    bool allocate(Arena& arena, std::size_t count_)
+    {
+        items = arena.carve_array<T>(count_);
+        free_slots = arena.carve_array<std::uint32_t>(count_);
+        count = (items && free_slots) ? count_ : 0;
+        // handed out from slot 0 up
+        for (std::size_t i = 0; i < count; i++)
+            free_slots[i] = (std::uint32_t)(count - 1 - i);
+        free_top = count;
+        in_use.store(0, std::memory_order_relaxed);
+        peak.store(0, std::memory_order_relaxed);
+        misses.store(0, std::memory_order_relaxed);
+        return count == count_;
+    }
+    // a fresh T, nullptr when every slot is out
+    T* acquire()
+    {
+        if (free_top == 0) {
+            misses.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        T* item = items + free_slots[--free_top];
+        *item = T{};
+        const std::size_t live = count - free_top;
+        in_use.store(live, std::memory_order_relaxed);
+        if (live > peak.load(std::memory_order_relaxed))
+            peak.store(live, std::memory_order_relaxed);
+        return item;
+    }
+    void release(T* item)
+    {
+        free_slots[free_top++] = (std::uint32_t)(item - items);
+        in_use.store(count - free_top, std::memory_order_relaxed);
+    }
+    T&          operator[](std::size_t i) { return items[i]; }
+    const T&    operator[](std::size_t i) const { return items[i]; }
+    std::size_t index_of(const T* item) const { return (std::size_t)(item - items); }
+    std::size_t capacity() const   { return count; }
+    std::size_t live() const       { return in_use.load(std::memory_order_relaxed); }
+    std::size_t high_water() const { return peak.load(std::memory_order_relaxed); }
+    std::size_t failures() const   { return misses.load(std::memory_order_relaxed); }
+};
+
+// Scratch for one block: allocations bump a pointer through a region carved from an arena, and
+// reset() at the top of the next block takes it all back. Audio thread only.
+class BlockArena
+{
+private:
+    std::byte*  base     = nullptr;
+    std::size_t capacity = 0;
+    std::size_t top      = 0;
+    std::atomic<std::size_t> peak{ 0 };
+    std::atomic<std::size_t> misses{ 0 };
+public:
+    bool allocate(Arena& arena, std::size_t bytes);
+    void reset() { top = 0; }
+    // count uninitialised T, nullptr when the block has used the region up
+    template <typename T>
+    T* take(std::size_t count)
+    {
+        static_assert(std::is_trivially_destructible_v<T>, "scratch is never destroyed");
+        const std::size_t bytes = arena_round(count * sizeof(T));
+        if (top + bytes > capacity) {
+            misses.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        T* items = reinterpret_cast<T*>(base + top);
+        top += bytes;
+        if (top > peak.load(std::memory_order_relaxed))
+            peak.store(top, std::memory_order_relaxed);
+        return items;
+    }
+    std::size_t size() const       { return capacity; }
+    std::size_t high_water() const { return peak.load(std::memory_order_relaxed); }
+    std::size_t failures() const   { return misses.load(std::memory_order_relaxed); }
+};
@@ -0,0 +1,115 @@
+#include <chrono>
+#include "AudioBackend.h"
+#include "Synth.h"
+#include "Trace.h"
+
+ThreadedBackend::ThreadedBackend(unsigned long frames_per_buffer, bool realtime)
+    : frames_per_buffer(frames_per_buffer), realtime(realtime)
+{
+}
+
+ThreadedBackend::~ThreadedBackend() {
+    stop();
+}
+
+bool ThreadedBackend::open(Synth* synth_) {
+    if (synth_ == 0 || frames_per_buffer == 0)
+        return false;
+    synth = synth_;
+    buffer.assign(2 * frames_per_buffer, 0.0f);
+    return true;
+}
+
+bool ThreadedBackend::close() {
+    stop();
+    if (synth == 0)
+        return false;
+    synth = 0;
+    return true;
+}
+
+bool ThreadedBackend::start() {
+    if (synth == 0 || running)
+        return false;
+    // a worker that ended on a failed deliver() has not been joined yet
+    if (worker.joinable())
+        worker.join();
+    running = true;
+    worker = std::thread(&ThreadedBackend::run, this);
+    return true;
+}
+
+bool ThreadedBackend::stop() {
+    if (!worker.joinable())
+        return false;
+    running = false;
+    worker.join();
+    return true;
+}
+
+void ThreadedBackend::run() {
+    using clock = std::chrono::steady_clock;
+    const auto period = std::chrono::duration_cast<clock::duration>(
+        std::chrono::duration<double>((double)frames_per_buffer / SAMPLE_RATE));
+    auto deadline = clock::now();
+
+    trace_thread("audio");
+    while (running) {
+        const std::uint64_t entered = timing_ticks();
+        {
+            TraceZone zone("callback");
+            synth->render(buffer.data(), frames_per_buffer);
+        }
+        // paced output underflows when a block is finished after its deadline, like a sound card would
+        timing.record(entered, timing_ticks(), frames_per_buffer, realtime && clock::now() > deadline + period);
+        if (!deliver(buffer.data(), frames_per_buffer)) {
+            running = false;
+            break;
+        }
+        if (realtime) {
+            deadline += period;
+            std::this_thread::sleep_until(deadline);
+        }
+    }
+}
+
+FileBackend::FileBackend(std::string path, unsigned long frames_per_buffer, bool realtime)
+    : ThreadedBackend(frames_per_buffer, realtime), path(std::move(path))
+{
+    use_wav = this->path.size() > 4 && this->path.compare(this->path.size() - 4, 4, ".wav") == 0;
+}
+
+FileBackend::~FileBackend() {
+    // the worker writes through wav and raw, so it stops before they go
+    close();
+}
+
+bool FileBackend::open(Synth* synth_) {
+    if (use_wav) {
+        if (!wav.open(path.c_str(), 2, SAMPLE_RATE))
+            return false;
+    }
+    else {
+        raw = (path == "-") ? stdout : fopen(path.c_str(), "wb");
+        if (raw == 0)
+            return false;
+    }
+    return ThreadedBackend::open(synth_);
+}
+
+bool FileBackend::close() {
+    bool ok = ThreadedBackend::close();
+    if (use_wav)
+        ok = wav.close() && ok;
+    else if (raw != 0) {
+        ok = ((raw == stdout) ? fflush(raw) : fclose(raw)) == 0 && ok;
+        raw = 0;
+    }
+    return ok;
+}
+
+bool FileBackend::deliver(const float* interleaved, unsigned long frames) {
+    if (use_wav)
+        return wav.write(interleaved, frames);
+    return fwrite(interleaved, 2 * sizeof(float), frames, raw) == frames;
+}
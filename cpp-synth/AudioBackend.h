@@ -0,0 +1,78 @@
+#pragma once
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+#include "CallbackTiming.h"
+#include "wavfile.h"
+
+class Synth;
+
+// Where rendered blocks go. The backend owns the thread that calls Synth::render, and times it.
+class AudioBackend
+{
+protected:
+    CallbackTiming timing;
+public:
+    virtual ~AudioBackend() = default;
+    virtual bool open(Synth* synth) = 0;
+    virtual bool close() = 0;
+    virtual bool start() = 0;
+    virtual bool stop() = 0;
+    virtual unsigned long block_size() const = 0;
+    const CallbackTiming& callback_timing() const { return timing; }
+    void reset_timing() { timing.reset(); }
+};
+
+// Renders on its own thread, optionally paced to realtime by a timer.
+class ThreadedBackend : public AudioBackend
+{
+private:
+    std::thread worker;
+    std::atomic<bool> running{ false };
+    std::vector<float> buffer;
+    void run();
+protected:
+    Synth* synth{ 0 };
+    unsigned long frames_per_buffer;
+    bool realtime;
+    virtual bool deliver(const float* interleaved, unsigned long frames) = 0;
+public:
+    ThreadedBackend(unsigned long frames_per_buffer, bool realtime);
+    // too late to stop the worker here, deliver() is gone by now; each sink stops in its own destructor
+    ~ThreadedBackend() override;
+    bool open(Synth* synth) override;
+    bool close() override;
+    bool start() override;
+    bool stop() override;
+    unsigned long block_size() const override { return frames_per_buffer; }
+};
+
+// Discards output, for load tests and CI on machines without a sound card.
+class NullBackend : public ThreadedBackend
+{
+protected:
+    bool deliver(const float*, unsigned long) override { return true; }
+public:
+    explicit NullBackend(unsigned long frames_per_buffer = 512, bool realtime = true)
+        : ThreadedBackend(frames_per_buffer, realtime) {}
+    ~NullBackend() override { stop(); }
+};
+
+// Writes interleaved float32 to a file or to stdout ("-"), as WAV when the path ends in .wav and raw otherwise.
+class FileBackend : public ThreadedBackend
+{
+private:
+    std::string path;
+    FILE* raw{ 0 };
+    WavWriter wav;
+    bool use_wav{ false };
+protected:
+    bool deliver(const float* interleaved, unsigned long frames) override;
+public:
+    FileBackend(std::string path, unsigned long frames_per_buffer = 512, bool realtime = false);
+    ~FileBackend() override;
+    bool open(Synth* synth) override;
+    bool close() override;
+};
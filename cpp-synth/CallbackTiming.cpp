@@ -0,0 +1,128 @@
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <thread>
+#include "CallbackTiming.h"
+#include "wavetable.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TIMING_TSC 1
+#elif defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#define TIMING_TSC 1
+#endif
+
+std::uint64_t timing_ticks() {
+#ifdef TIMING_TSC
+    return __rdtsc();
+#else
+    return (std::uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+double ns_per_tick() {
+#ifdef TIMING_TSC
+    static const double scale = [] {
+        using clock = std::chrono::steady_clock;
+        const auto started = clock::now();
+        const std::uint64_t first = timing_ticks();
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        const std::uint64_t ticks = timing_ticks() - first;
+        const double ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - started).count();
+        return ticks ? ns / (double)ticks : 1.0;
+    }();
+    return scale;
+#else
+    return 1.0;
+#endif
+}
+
+int LoadHistogram::bucket_of(std::uint64_t ticks) {
+    if (ticks < HISTOGRAM_SUB)
+        return (int)ticks;
+    const int e = (int)std::bit_width(ticks) - 1;
+    return (e - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB + (int)((ticks >> (e - HISTOGRAM_SUB_BITS)) & (HISTOGRAM_SUB - 1));
+}
+
+std::uint64_t LoadHistogram::bucket_top(int bucket) {
+    if (bucket < HISTOGRAM_SUB)
+        return (std::uint64_t)bucket;
+    const int e = bucket / HISTOGRAM_SUB + HISTOGRAM_SUB_BITS - 1;
+    const std::uint64_t step = std::uint64_t{ 1 } << (e - HISTOGRAM_SUB_BITS);
+    return (HISTOGRAM_SUB + (std::uint64_t)(bucket % HISTOGRAM_SUB)) * step + step - 1;
+}
+
+void LoadHistogram::add(std::uint64_t ticks) {
+    // one writer, so plain load and store instead of a locked add
+    std::atomic<std::uint64_t>& b = buckets[bucket_of(ticks)];
+    b.store(b.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    if (ticks > largest.load(std::memory_order_relaxed))
+        largest.store(ticks, std::memory_order_relaxed);
+}
+
+void LoadHistogram::reset() {
+    for (auto& b : buckets)
+        b.store(0, std::memory_order_relaxed);
+    largest.store(0, std::memory_order_relaxed);
+}
+
+std::uint64_t LoadHistogram::count() const {
+    std::uint64_t n = 0;
+    for (const auto& b : buckets)
+        n += b.load(std::memory_order_relaxed);
+    return n;
+}
+
+std::uint64_t LoadHistogram::percentile(double q) const {
+    std::uint64_t counts[HISTOGRAM_BUCKETS];
+    std::uint64_t n = 0;
+    for (int b = 0; b < HISTOGRAM_BUCKETS; b++)
+        n += counts[b] = buckets[b].load(std::memory_order_relaxed);
+    if (n == 0)
+        return 0;
+    // the value ranked ceil(q * n), counting from 1
+    const std::uint64_t rank = std::max<std::uint64_t>(1, (std::uint64_t)((double)n * q + 0.999999));
+    std::uint64_t seen = 0;
+    for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+        seen += counts[b];
+        if (seen >= rank)
+            return std::min(bucket_top(b), max());
+    }
+    return max();
+}
+
+void CallbackTiming::record(std::uint64_t entered, std::uint64_t left, unsigned long frames_, bool underflow, bool overflow) {
+    durations.add(left - entered);
+    frames.store(frames_, std::memory_order_relaxed);
+    if (underflow)
+        underflows.store(underflows.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    if (overflow)
+        overflows.store(overflows.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+void CallbackTiming::reset() {
+    durations.reset();
+    underflows.store(0, std::memory_order_relaxed);
+    overflows.store(0, std::memory_order_relaxed);
+}
+
+LoadStats CallbackTiming::stats() const {
+    LoadStats s;
+    s.callbacks = durations.count();
+    s.underflows = underflows.load(std::memory_order_relaxed);
+    s.overflows = overflows.load(std::memory_order_relaxed);
+    const unsigned long block = frames.load(std::memory_order_relaxed);
+    if (s.callbacks == 0 || block == 0)
+        return s;
+    s.period_us = 1e6 * block / SAMPLE_RATE;
+    const double period_ticks = s.period_us * 1000.0 / ns_per_tick();
+    s.p50 = durations.percentile(0.5) / period_ticks;
+    s.p99 = durations.percentile(0.99) / period_ticks;
+    s.p999 = durations.percentile(0.999) / period_ticks;
+    s.max = durations.max() / period_ticks;
+    // whole buckets past the period, so to within a bucket's width
+    for (int b = 0; b < HISTOGRAM_BUCKETS; b++)
+        if (b > 0 && (double)LoadHistogram::bucket_top(b - 1) >= period_ticks)
+            s.late += durations.bucket(b);
+    return s;
+}
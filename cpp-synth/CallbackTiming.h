@@ -0,0 +1,65 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Monotonic timestamp cheap enough for every callback: the TSC on x86, which is constant rate on
+// anything recent, and the steady clock in nanoseconds elsewhere.
+std::uint64_t timing_ticks();
+// measured once against the steady clock, on the first call
+double        ns_per_tick();
+
+// log2 buckets split into 2^HISTOGRAM_SUB_BITS linear steps, values within 12.5% of their bucket
+constexpr auto HISTOGRAM_SUB_BITS = 3;
+constexpr auto HISTOGRAM_SUB      = 1 << HISTOGRAM_SUB_BITS;
+constexpr auto HISTOGRAM_BUCKETS  = (64 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB;
+
+// Histogram of durations in ticks. add() is lock-free and meant for one writer, readers on any
+// thread see every count as it was at some point, close enough for percentiles.
+class LoadHistogram
+{
+private:
+    std::atomic<std::uint64_t> buckets[HISTOGRAM_BUCKETS]{};
+    std::atomic<std::uint64_t> largest{ 0 };
+public:
+    static int           bucket_of(std::uint64_t ticks);
+    // the largest value that lands in bucket
+    static std::uint64_t bucket_top(int bucket);
+    void                 add(std::uint64_t ticks);
+    // from any thread, a value added at the same moment may survive it
+    void                 reset();
+    std::uint64_t        count() const;
+    std::uint64_t        bucket(int b) const { return buckets[b].load(std::memory_order_relaxed); }
+    std::uint64_t        max() const { return largest.load(std::memory_order_relaxed); }
+    // the top of the bucket holding quantile q of the values, in ticks
+    std::uint64_t        percentile(double q) const;
+};
+
+// percentiles of the callback time as a share of the buffer period, 1 is a missed deadline
+struct LoadStats
+{
+    std::uint64_t callbacks  = 0;
+    std::uint64_t underflows = 0;
+    std::uint64_t overflows  = 0;
+    // callbacks that took longer than the period
+    std::uint64_t late       = 0;
+    double        period_us  = 0;
+    double        p50 = 0, p99 = 0, p999 = 0, max = 0;
+};
+
+// Entry to exit time of every audio callback and the xruns the driver reported. The backend's audio
+// thread calls record(), anything else reads stats().
+class CallbackTiming
+{
+private:
+    LoadHistogram              durations;
+    std::atomic<std::uint64_t> underflows{ 0 };
+    std::atomic<std::uint64_t> overflows{ 0 };
+    std::atomic<unsigned long> frames{ 0 };
+public:
+    // entered and left from timing_ticks()
+    void      record(std::uint64_t entered, std::uint64_t left, unsigned long frames, bool underflow = false, bool overflow = false);
+    void      reset();
+    LoadStats stats() const;
+    const LoadHistogram& histogram() const { return durations; }
+};
@@ -0,0 +1,59 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Wait-free single-producer/single-consumer ring. One thread may push and one other thread may pop.
+template <typename T, std::size_t N>
+class SpscQueue
+{
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "capacity must be a power of two");
+private:
+    T items[N];
+    alignas(64) std::atomic<std::size_t> head{ 0 };
+    alignas(64) std::atomic<std::size_t> tail{ 0 };
+public:
+    // producer side, false when the ring is full
+    bool push(const T& item)
+    {
+        const std::size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == N)
+            return false;
+        items[t & (N - 1)] = item;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer side, false when the ring is empty
+    bool pop(T& item)
+    {
+        const std::size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+            return false;
+        item = items[h & (N - 1)];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+};
+
+enum class Param { attack, decay, sustain, release, osc_amp };
+
+// GUI to audio thread message, applied at the top of the next block
+struct Command
+{
+    enum class Type { note_on, note_off, set_param };
+    Type  type     = Type::note_on;
+    int   osc      = 0;
+    int   note     = 0;
+    Param param    = Param::attack;
+    float value    = 0.0f;
+    // sample clock to apply it at, anything already past means the next block
+    std::uint64_t at = 0;
+};
+
+// a command waiting for its sample in the audio thread's time ordered list
+struct Event
+{
+    Command cmd;
+    Event*  next = nullptr;
+};
@@ -0,0 +1,381 @@
+#include <algorithm>
+#include <cmath>
+#include <numbers>
+#include "Patch.h"
+#include "Scheduler.h"
+
+namespace {
+    void default_params(NodeKind kind, float* params) {
+        switch (kind)
+        {
+            case NodeKind::oscillator: params[0] = 0; break;
+            case NodeKind::envelope:   params[0] = 10; params[1] = 200; params[2] = 0.7f; params[3] = 300; break;
+            case NodeKind::filter:     params[0] = (float)FilterMode::lowpass; params[1] = 2000; params[2] = 0.707f; break;
+            case NodeKind::mixer:      std::fill_n(params, NODE_PARAMS, 1.0f); break;
+            case NodeKind::effect:     params[0] = 250; params[1] = 0.35f; params[2] = 0.3f; break;
+        }
+    }
+
+    // inputs a node of this kind reads
+    int input_count(NodeKind kind) {
+        switch (kind)
+        {
+            case NodeKind::oscillator: return 0;
+            case NodeKind::mixer:      return NODE_INPUTS;
+            default:                   return 1;
+        }
+    }
+
+    // biquad coefficients after the RBJ audio EQ cookbook
+    void filter_coefficients(PlanStep& step) {
+        const float cutoff = std::clamp(step.params[1], 20.0f, 0.45f * SAMPLE_RATE);
+        const float q = std::clamp(step.params[2], 0.1f, 20.0f);
+        const double w0 = 2 * std::numbers::pi * cutoff / SAMPLE_RATE;
+        const double cw = std::cos(w0), alpha = std::sin(w0) / (2 * q);
+        double b0, b1, b2;
+        switch ((FilterMode)(int)step.params[0])
+        {
+            case FilterMode::highpass: b0 = (1 + cw) / 2; b1 = -(1 + cw); b2 = (1 + cw) / 2; break;
+            case FilterMode::bandpass: b0 = alpha;        b1 = 0;         b2 = -alpha;       break;
+            default:                   b0 = (1 - cw) / 2; b1 = 1 - cw;    b2 = (1 - cw) / 2; break;
+        }
+        const double a0 = 1 + alpha;
+        step.b0 = (float)(b0 / a0);
+        step.b1 = (float)(b1 / a0);
+        step.b2 = (float)(b2 / a0);
+        step.a1 = (float)(-2 * cw / a0);
+        step.a2 = (float)((1 - alpha) / a0);
+    }
+}
+
+PatchNode* Patch::find(int id) {
+    for (auto& node : nodes)
+        if (node.id == id)
+            return &node;
+    return nullptr;
+}
+
+const PatchNode* Patch::find(int id) const {
+    for (const auto& node : nodes)
+        if (node.id == id)
+            return &node;
+    return nullptr;
+}
+
+int Patch::add(NodeKind kind) {
+    int id = 0;
+    for (const auto& node : nodes)
+        id = std::max(id, node.id + 1);
+    PatchNode node;
+    node.id = id;
+    node.kind = kind;
+    default_params(kind, node.params);
+    nodes.push_back(node);
+    return id;
+}
+
+void Patch::remove(int id) {
+    std::erase_if(nodes, [id](const PatchNode& node) { return node.id == id; });
+    for (auto& node : nodes)
+        for (int& input : node.inputs)
+            if (input == id)
+                input = -1;
+    if (output == id)
+        output = -1;
+}
+
+Patch default_patch() {
+    Patch patch;
+    const int mixer = patch.add(NodeKind::mixer);
+    for (int o = 0; o < OSC_COUNT; o++) {
+        const int osc = patch.add(NodeKind::oscillator);
+        patch.find(osc)->params[0] = (float)o;
+        patch.find(mixer)->inputs[o] = osc;
+    }
+    patch.output = mixer;
+    return patch;
+}
+
+bool PatchPlan::compile(const Patch& patch, std::string* error) {
+    auto fail = [error](const std::string& why) {
+        if (error)
+            *error = why;
+        return false;
+    };
+    const std::size_t count = patch.nodes.size();
+    auto index_of = [&patch](int id) {
+        for (std::size_t n = 0; n < patch.nodes.size(); n++)
+            if (patch.nodes[n].id == id)
+                return (int)n;
+        return -1;
+    };
+    const int out = index_of(patch.output);
+    if (out < 0)
+        return fail("no output node");
+
+    // inputs as node indices, only the ones the kind reads
+    std::vector<std::vector<int>> inputs(count);
+    for (std::size_t n = 0; n < count; n++) {
+        const PatchNode& node = patch.nodes[n];
+        for (int k = 0; k < input_count(node.kind); k++) {
+            if (node.inputs[k] < 0)
+                continue;
+            const int from = index_of(node.inputs[k]);
+            if (from < 0)
+                return fail("node " + std::to_string(node.id) + " reads missing node " + std::to_string(node.inputs[k]));
+            inputs[n].push_back(from);
+        }
+    }
+
+    // only what the output hears is compiled
+    std::vector<bool> needed(count, false);
+    std::vector<int> stack{ out };
+    needed[out] = true;
+    while (!stack.empty()) {
+        const int n = stack.back();
+        stack.pop_back();
+        for (int from : inputs[n])
+            if (!needed[from]) {
+                needed[from] = true;
+                stack.push_back(from);
+            }
+    }
+
+    // Kahn's sort, ties go in patch order; the output comes last since everything else feeds it
+    std::vector<int> pending(count, 0), order;
+    std::vector<std::vector<int>> readers(count);
+    std::size_t needed_count = 0;
+    for (std::size_t n = 0; n < count; n++) {
+        if (!needed[n])
+            continue;
+        ++needed_count;
+        pending[n] = (int)inputs[n].size();
+        for (int from : inputs[n])
+            readers[from].push_back((int)n);
+    }
+    for (std::size_t n = 0; n < count; n++)
+        if (needed[n] && pending[n] == 0)
+            order.push_back((int)n);
+    for (std::size_t i = 0; i < order.size(); i++)
+        for (int reader : readers[order[i]])
+            if (--pending[reader] == 0)
+                order.push_back(reader);
+    if (order.size() != needed_count)
+        return fail("the patch has a cycle");
+
+    // what each node depends on, directly or not, for handing buffers on
+    std::vector<std::vector<bool>> ancestor(count, std::vector<bool>(count, false));
+    for (int n : order)
+        for (int from : inputs[n]) {
+            ancestor[n][from] = true;
+            for (std::size_t a = 0; a < count; a++)
+                if (ancestor[from][a])
+                    ancestor[n][a] = true;
+        }
+
+    // A buffer is free for a node once the node depends on every reader of it, which also orders
+    // the write after its last writer. Oscillators are read straight from their bus and the output
+    // buffer is never handed on.
+    std::vector<int> buffer_of(count, -1), step_of(count, -1), holder;
+    steps.assign(order.size(), PlanStep{});
+    buffers = 0;
+    for (std::size_t i = 0; i < order.size(); i++) {
+        const int n = order[i];
+        const PatchNode& node = patch.nodes[n];
+        PlanStep& step = steps[i];
+        step.kind = node.kind;
+        step.node = node.id;
+        step_of[n] = (int)i;
+        std::copy_n(node.params, NODE_PARAMS, step.params);
+
+        if (node.kind == NodeKind::oscillator) {
+            buffer_of[n] = BUS_BUFFER + std::clamp((int)node.params[0], 0, OSC_COUNT - 1);
+            step.reads_bus = true;
+        }
+        else {
+            for (int b = 0; b < buffers && buffer_of[n] < 0; b++)
+                if (holder[b] != out && std::all_of(readers[holder[b]].begin(), readers[holder[b]].end(),
+                                                    [&](int reader) { return ancestor[n][reader]; }))
+                    buffer_of[n] = b;
+            if (buffer_of[n] < 0) {
+                buffer_of[n] = buffers++;
+                holder.push_back(n);
+            }
+            holder[buffer_of[n]] = n;
+        }
+        step.output = buffer_of[n];
+        for (int k = 0, j = 0; k < input_count(node.kind); k++)
+            if (node.inputs[k] >= 0)
+                step.inputs[k] = buffer_of[inputs[n][j++]];
+        int after = 0;
+        for (int from : inputs[n]) {
+            if (patch.nodes[from].kind == NodeKind::oscillator)
+                step.reads_bus = true;
+            else if (std::find(step.after, step.after + after, step_of[from]) == step.after + after)
+                step.after[after++] = step_of[from];
+        }
+
+        switch (node.kind)
+        {
+            case NodeKind::envelope:
+                step.adsr.attack_time = std::max(step.params[0], 0.0f);
+                step.adsr.decay_time = std::max(step.params[1], 0.0f);
+                step.adsr.sustain_amp = std::clamp(step.params[2], 0.0f, 1.0f);
+                step.adsr.release_time = std::max(step.params[3], 0.01f);
+                break;
+            case NodeKind::filter:
+                filter_coefficients(step);
+                break;
+            case NodeKind::oscillator:
+            case NodeKind::mixer:
+                break;
+            case NodeKind::effect:
+                step.params[1] = std::clamp(step.params[1], 0.0f, 0.95f);
+                step.delay.assign(2 * std::max<std::uint64_t>(ms_to_samples(std::clamp(step.params[0], 1.0f, MAX_DELAY_MS)), 1), 0.0f);
+                break;
+        }
+    }
+    pool.assign((std::size_t)buffers * 2 * MAX_BLOCK_SIZE, 0.0f);
+
+    // as graph nodes: each task is an edge out of the steps it reads, and the mixdown has one to
+    // every task reading a bus
+    std::vector<int> successors(steps.size(), 0);
+    int bus_readers = 0;
+    for (std::size_t i = 0; i < steps.size(); i++) {
+        if (!task(i))
+            continue;
+        bus_readers += steps[i].reads_bus;
+        for (int a : steps[i].after)
+            if (a >= 0)
+                successors[a]++;
+    }
+    parallel_ = steps.size() <= MAX_PATCH_TASKS && bus_readers <= MAX_SUCCESSORS
+        && std::all_of(successors.begin(), successors.end(), [](int s) { return s <= MAX_SUCCESSORS; });
+    return true;
+}
+
+void PatchPlan::adopt(PatchPlan& previous) {
+    for (auto& step : steps) {
+        auto old = std::find_if(previous.steps.begin(), previous.steps.end(),
+            [&step](const PlanStep& s) { return s.node == step.node && s.kind == step.kind; });
+        if (old == previous.steps.end())
+            continue;
+        step.env = old->env;
+        step.gate = old->gate;
+        std::copy_n(old->z1, 2, step.z1);
+        std::copy_n(old->z2, 2, step.z2);
+        // same length lines trade storage, the old plan is freed off the audio thread
+        if (old->delay.size() == step.delay.size()) {
+            step.delay.swap(old->delay);
+            step.delay_pos = old->delay_pos;
+        }
+    }
+}
+
+void PatchPlan::begin(const float* const* bus_left_, const float* const* bus_right_, bool gate_, std::uint64_t clock_,
+                      float* left_, float* right_, unsigned long frames_) {
+    std::copy_n(bus_left_, OSC_COUNT, bus_left);
+    std::copy_n(bus_right_, OSC_COUNT, bus_right);
+    gate = gate_;
+    clock = clock_;
+    out_left = left_;
+    out_right = right_;
+    frames = frames_;
+}
+
+void PatchPlan::run(const float* const* bus_left_, const float* const* bus_right_, bool gate_, std::uint64_t clock_,
+                    float* left_, float* right_, unsigned long frames_) {
+    begin(bus_left_, bus_right_, gate_, clock_, left_, right_, frames_);
+    for (std::size_t i = 0; i < steps.size(); i++)
+        run_step(i);
+}
+
+void PatchPlan::run_step(std::size_t index) {
+    process(steps[index]);
+    if (index + 1 < steps.size())
+        return;
+    const int result = steps.back().output;
+    std::copy_n(source_left(result), frames, out_left);
+    std::copy_n(source_right(result), frames, out_right);
+}
+
+void PatchPlan::process(PlanStep& step) {
+    if (step.kind == NodeKind::oscillator)
+        return;
+    float* l = left(step.output);
+    float* r = right(step.output);
+    const int in = step.inputs[0];
+    if (step.kind == NodeKind::mixer) {
+        std::fill_n(l, frames, 0.0f);
+        std::fill_n(r, frames, 0.0f);
+        for (int k = 0; k < NODE_INPUTS; k++) {
+            if (step.inputs[k] < 0)
+                continue;
+            const float g = step.params[k];
+            const float* il = source_left(step.inputs[k]);
+            const float* ir = source_right(step.inputs[k]);
+            for (unsigned long i = 0; i < frames; i++) {
+                l[i] += g * il[i];
+                r[i] += g * ir[i];
+            }
+        }
+        return;
+    }
+    // the rest process one input, unconnected they are silent
+    if (in < 0) {
+        std::fill_n(l, frames, 0.0f);
+        std::fill_n(r, frames, 0.0f);
+        return;
+    }
+    const float* il = source_left(in);
+    const float* ir = source_right(in);
+    switch (step.kind)
+    {
+        case NodeKind::envelope:
+            // notes land between blocks, so the gate only changes at the start of one
+            if (gate && !step.gate)
+                step.env.key_on(clock);
+            else if (!gate && step.gate)
+                step.env.key_off(step.adsr, clock);
+            step.gate = gate;
+            for (unsigned long i = 0; i < frames; i++) {
+                const float amp = step.env.get_amp(step.adsr, clock + i);
+                l[i] = amp * il[i];
+                r[i] = amp * ir[i];
+            }
+            break;
+        case NodeKind::filter:
+            for (int c = 0; c < 2; c++) {
+                const float* x = c ? ir : il;
+                float* y = c ? r : l;
+                float z1 = step.z1[c], z2 = step.z2[c];
+                for (unsigned long i = 0; i < frames; i++) {
+                    const float v = step.b0 * x[i] + z1;
+                    z1 = step.b1 * x[i] - step.a1 * v + z2;
+                    z2 = step.b2 * x[i] - step.a2 * v;
+                    y[i] = v;
+                }
+                step.z1[c] = z1;
+                step.z2[c] = z2;
+            }
+            break;
+        case NodeKind::effect: {
+            const float feedback = step.params[1], wet = step.params[2];
+            const std::size_t length = step.delay.size() / 2;
+            std::size_t pos = step.delay_pos;
+            for (unsigned long i = 0; i < frames; i++) {
+                const float dl = step.delay[2 * pos], dr = step.delay[2 * pos + 1];
+                step.delay[2 * pos] = il[i] + feedback * dl;
+                step.delay[2 * pos + 1] = ir[i] + feedback * dr;
+                l[i] = il[i] + wet * dl;
+                r[i] = ir[i] + wet * dr;
+                if (++pos == length)
+                    pos = 0;
+            }
+            step.delay_pos = pos;
+            break;
+        }
+        default:
+            break;
+    }
+}
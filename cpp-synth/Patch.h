@@ -0,0 +1,124 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "wavetable.h"
+#include "Voice.h"
+
+enum class NodeKind { oscillator, envelope, filter, mixer, effect };
+constexpr const char* NODE_KIND_NAMES[] = { "Oscillator", "Envelope", "Filter", "Mixer", "Delay" };
+// params[0] of a filter node
+enum class FilterMode { lowpass, highpass, bandpass };
+constexpr const char* FILTER_MODE_NAMES[] = { "Lowpass", "Highpass", "Bandpass" };
+constexpr auto NODE_INPUTS = 4;
+constexpr auto NODE_PARAMS = 4;
+// longest delay an effect node can hold
+constexpr auto MAX_DELAY_MS = 2000.0f;
+
+// One node of the editable patch, what the params mean depends on the kind:
+//   oscillator  the voice layers of oscillator params[0], each with its own envelope
+//   envelope    attack ms, decay ms, sustain, release ms, gated while any note is held
+//   filter      mode, cutoff Hz, resonance
+//   mixer       the gain of each input
+//   effect      feedback delay: time ms, feedback, wet level
+// Only the mixer reads more than inputs[0].
+struct PatchNode
+{
+    int      id     = 0;
+    NodeKind kind   = NodeKind::mixer;
+    float    params[NODE_PARAMS]{};
+    // ids of the nodes feeding this one, -1 when unconnected
+    int      inputs[NODE_INPUTS]{ -1, -1, -1, -1 };
+};
+
+// the graph as the GUI edits it, the audio thread only ever sees it compiled into a PatchPlan
+struct Patch
+{
+    std::vector<PatchNode> nodes;
+    int                    output = -1;
+    PatchNode*             find(int id);
+    const PatchNode*       find(int id) const;
+    // a new node with the default params of its kind, returns its id
+    int                    add(NodeKind kind);
+    // drops the node and every connection to it
+    void                   remove(int id);
+};
+
+// the three oscillators summed, the signal flow the synth had before patches
+Patch default_patch();
+
+// buffer numbers from here on are the oscillator buses rather than the plan's pool
+constexpr auto BUS_BUFFER = 1 << 16;
+// steps a plan may have to run as render graph nodes of their own, a bigger one runs as one node
+constexpr auto MAX_PATCH_TASKS = 32;
+
+// one node call of a compiled plan, inputs and output are buffer numbers, -1 when unconnected
+struct PlanStep
+{
+    NodeKind           kind   = NodeKind::mixer;
+    int                node   = 0;
+    int                output = 0;
+    int                inputs[NODE_INPUTS]{ -1, -1, -1, -1 };
+    // steps whose output this one reads, -1 past the last
+    int                after[NODE_INPUTS]{ -1, -1, -1, -1 };
+    // reads an oscillator bus or is one, so it waits for the mixdown
+    bool               reads_bus = false;
+    float              params[NODE_PARAMS]{};
+    // state carried from block to block
+    ADSR               adsr;
+    Envelope           env;
+    bool               gate = false;
+    float              b0 = 0, b1 = 0, b2 = 0, a1 = 0, a2 = 0;
+    float              z1[2]{}, z2[2]{};
+    std::vector<float> delay;
+    std::size_t        delay_pos = 0;
+};
+
+// A patch compiled for the audio thread: the nodes that reach the output in dependency order, each
+// writing a buffer from a pool. A buffer is only handed on to a step that depends on every reader of
+// its last contents, so steps on independent branches can run at the same time. Everything is
+// allocated by compile(), running the plan never allocates.
+class PatchPlan
+{
+private:
+    std::vector<PlanStep> steps;
+    std::vector<float>    pool;
+    int                   buffers = 0;
+    bool                  parallel_ = false;
+    // this block's inputs and output, set by begin()
+    const float*          bus_left[OSC_COUNT]{};
+    const float*          bus_right[OSC_COUNT]{};
+    bool                  gate = false;
+    std::uint64_t         clock = 0;
+    float*                out_left = nullptr;
+    float*                out_right = nullptr;
+    unsigned long         frames = 0;
+    float*                left(int buffer)  { return &pool[(std::size_t)buffer * 2 * MAX_BLOCK_SIZE]; }
+    float*                right(int buffer) { return left(buffer) + MAX_BLOCK_SIZE; }
+    const float*          source_left(int buffer)  { return buffer >= BUS_BUFFER ? bus_left[buffer - BUS_BUFFER] : left(buffer); }
+    const float*          source_right(int buffer) { return buffer >= BUS_BUFFER ? bus_right[buffer - BUS_BUFFER] : right(buffer); }
+    void                  process(PlanStep& step);
+public:
+    // false with the reason in error for a cycle, an input that does not exist or a missing output
+    bool        compile(const Patch& patch, std::string* error);
+    // takes over envelope, filter and delay state from the plan this one replaces, at the swap
+    void        adopt(PatchPlan& previous);
+    // bus_left/right hold the OSC_COUNT oscillator buses, the output is written to left/right
+    void        begin(const float* const* bus_left, const float* const* bus_right, bool gate, std::uint64_t clock,
+                      float* left, float* right, unsigned long frames);
+    // one step of the block begin() set up, once the steps in its after list have run; the last
+    // step also writes the output
+    void        run_step(std::size_t i);
+    // the steps with work to do: all but the oscillators, which only name a bus, and always the last
+    bool        task(std::size_t i) const { return steps[i].kind != NodeKind::oscillator || i + 1 == steps.size(); }
+    // every step in order
+    void        run(const float* const* bus_left, const float* const* bus_right, bool gate, std::uint64_t clock,
+                    float* left, float* right, unsigned long frames);
+    // the steps fit the render graph as nodes of their own: at most MAX_PATCH_TASKS of them, and
+    // none read by more steps than a node has successor edges
+    bool        parallel() const { return parallel_; }
+    std::size_t size() const { return steps.size(); }
+    int         buffers_used() const { return buffers; }
+    const PlanStep& step(std::size_t i) const { return steps[i]; }
+};
@@ -0,0 +1,305 @@
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include "PerfCounters.h"
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PERF_RDPMC 1
+#endif
+#endif
+
+namespace {
+
+std::atomic<bool>          enabled{ false };
+std::atomic<int>           first_error{ 0 };
+std::atomic<int>           threads_open{ 0 };
+// some open thread cannot read its counters with rdpmc, so the stages are not split
+std::atomic<bool>          unstaged{ false };
+std::atomic<int>           registered{ 0 };
+std::atomic<std::uint64_t> blocks{ 0 };
+std::atomic<std::uint64_t> totals[PERF_STAGES][PERF_EVENTS]{};
+
+// One thread's counters. The control thread opens them and publishes them through open; they stay
+// open until the process exits, a thread that ends leaves its descriptors behind, which only
+// matters when the render threads are changed over and over.
+struct ThreadCounters
+{
+    // written once by the thread itself, 0 until then
+    std::atomic<long> tid{ 0 };
+    std::atomic<bool> open{ false };
+    bool              rdpmc = false;
+    int               fds[PERF_EVENTS]{};
+#ifdef __linux__
+    perf_event_mmap_page* pages[PERF_EVENTS]{};
+#endif
+    // control thread only: whether the open was tried, and the group at the last reset
+    bool              tried = false;
+    std::uint64_t     base[PERF_EVENTS]{};
+    // the thread itself only
+    bool              synced = false;
+    std::uint64_t     last[PERF_EVENTS]{};
+    PerfStage         stage = PerfStage::none;
+};
+
+ThreadCounters              slots[PERF_THREADS];
+thread_local ThreadCounters* counters = nullptr;
+thread_local bool           thread_registered = false;
+
+#ifdef __linux__
+perf_event_attr event_attr(PerfEvent event) {
+    perf_event_attr attr{};
+    attr.size = sizeof(attr);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    const auto cache_miss = [&](std::uint64_t cache) {
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    };
+    switch (event) {
+        case PerfEvent::cycles:        attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_CPU_CYCLES; break;
+        case PerfEvent::instructions:  attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_INSTRUCTIONS; break;
+        case PerfEvent::l1d_misses:    cache_miss(PERF_COUNT_HW_CACHE_L1D); break;
+        case PerfEvent::llc_misses:    cache_miss(PERF_COUNT_HW_CACHE_LL); break;
+        case PerfEvent::branch_misses: attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_BRANCH_MISSES; break;
+    }
+    return attr;
+}
+
+long current_tid() {
+    return (long)syscall(SYS_gettid);
+}
+
+void close_counters(ThreadCounters& c) {
+    for (int e = 0; e < PERF_EVENTS; e++) {
+        if (c.pages[e])
+            munmap(c.pages[e], (std::size_t)sysconf(_SC_PAGESIZE));
+        if (c.fds[e] >= 0)
+            close(c.fds[e]);
+        c.pages[e] = nullptr;
+        c.fds[e] = -1;
+    }
+}
+
+// the whole group in one read: the number of counters, then each value; false when it fails
+bool read_group(const ThreadCounters& c, std::uint64_t* values) {
+    std::uint64_t group[1 + PERF_EVENTS]{};
+    if (read(c.fds[0], group, sizeof(group)) != (ssize_t)sizeof(group))
+        return false;
+    for (int e = 0; e < PERF_EVENTS; e++)
+        values[e] = group[1 + e];
+    return true;
+}
+
+// on the control thread, for the thread c belongs to
+void open_counters(ThreadCounters& c, long tid) {
+    c.tried = true;
+    for (int e = 0; e < PERF_EVENTS; e++) {
+        c.fds[e] = -1;
+        c.pages[e] = nullptr;
+    }
+    // one group led by the cycle counter, so the five are scheduled onto the pmu together
+    bool rdpmc = true;
+    for (int e = 0; e < PERF_EVENTS; e++) {
+        perf_event_attr attr = event_attr((PerfEvent)e);
+        attr.disabled = (e == 0);
+        c.fds[e] = (int)syscall(SYS_perf_event_open, &attr, (pid_t)tid, -1, e == 0 ? -1 : c.fds[0], 0);
+        if (c.fds[e] < 0) {
+            int expected = 0;
+            first_error.compare_exchange_strong(expected, errno);
+            close_counters(c);
+            return;
+        }
+        // the page the kernel publishes the counter's rdpmc index and offset in
+        void* page = mmap(nullptr, (std::size_t)sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, c.fds[e], 0);
+        c.pages[e] = (page == MAP_FAILED) ? nullptr : static_cast<perf_event_mmap_page*>(page);
+        rdpmc = rdpmc && c.pages[e] && c.pages[e]->cap_user_rdpmc;
+    }
+#ifndef PERF_RDPMC
+    rdpmc = false;
+#endif
+    ioctl(c.fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(c.fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    read_group(c, c.base);
+    c.rdpmc = rdpmc;
+    if (!rdpmc)
+        unstaged.store(true, std::memory_order_relaxed);
+    c.open.store(true, std::memory_order_release);
+    threads_open.fetch_add(1, std::memory_order_relaxed);
+}
+
+#ifdef PERF_RDPMC
+// false when the counter is not on this cpu right now
+bool read_rdpmc(const perf_event_mmap_page* page, std::uint64_t& value) {
+    std::uint32_t seq;
+    do {
+        seq = page->lock;
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        const std::uint32_t index = page->index;
+        if (!page->cap_user_rdpmc || index == 0)
+            return false;
+        const int width = page->pmc_width;
+        std::int64_t count = (std::int64_t)__rdpmc((int)index - 1);
+        count = (std::int64_t)((std::uint64_t)count << (64 - width)) >> (64 - width);
+        value = (std::uint64_t)(page->offset + count);
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+    } while (page->lock != seq);
+    return true;
+}
+#endif
+
+// on the thread itself, never a syscall
+bool read_counters(ThreadCounters& c, std::uint64_t* values) {
+#ifdef PERF_RDPMC
+    for (int e = 0; e < PERF_EVENTS; e++)
+        if (!read_rdpmc(c.pages[e], values[e]))
+            return false;
+    return true;
+#else
+    (void)c;
+    (void)values;
+    return false;
+#endif
+}
+#else
+long current_tid() {
+    return 0;
+}
+
+void open_counters(ThreadCounters& c, long) {
+    c.tried = true;
+    int expected = 0;
+    first_error.compare_exchange_strong(expected, ENOSYS);
+}
+
+bool read_group(const ThreadCounters&, std::uint64_t*) {
+    return false;
+}
+
+bool read_counters(ThreadCounters&, std::uint64_t*) {
+    return false;
+}
+#endif
+
+} // namespace
+
+void perf_register_thread() {
+    if (thread_registered)
+        return;
+    thread_registered = true;
+    const int slot = registered.fetch_add(1, std::memory_order_relaxed);
+    if (slot >= PERF_THREADS)
+        return;
+    counters = &slots[slot];
+    counters->tid.store(current_tid(), std::memory_order_release);
+}
+
+void perf_open_threads() {
+    const int count = std::min(registered.load(std::memory_order_relaxed), PERF_THREADS);
+    for (int t = 0; t < count; t++) {
+        ThreadCounters& c = slots[t];
+        const long tid = c.tid.load(std::memory_order_acquire);
+        if (!c.tried && tid != 0)
+            open_counters(c, tid);
+    }
+}
+
+void perf_enable(bool on) {
+    if (on)
+        perf_open_threads();
+    enabled.store(on, std::memory_order_relaxed);
+}
+
+bool perf_enabled() {
+    return enabled.load(std::memory_order_relaxed);
+}
+
+void perf_count_block() {
+    if (perf_enabled())
+        blocks.fetch_add(1, std::memory_order_relaxed);
+}
+
+void perf_reset() {
+    for (auto& stage : totals)
+        for (auto& count : stage)
+            count.store(0, std::memory_order_relaxed);
+    for (ThreadCounters& c : slots)
+        if (c.open.load(std::memory_order_acquire))
+            read_group(c, c.base);
+    blocks.store(0, std::memory_order_relaxed);
+}
+
+PerfStage perf_switch(PerfStage stage) {
+    ThreadCounters* c = counters;
+    if (c == nullptr)
+        return PerfStage::none;
+    const PerfStage previous = c->stage;
+    c->stage = stage;
+    // stages are only counted with rdpmc, a read() here would be a syscall inside the callback
+    if (!c->open.load(std::memory_order_acquire) || !c->rdpmc)
+        return previous;
+    // a counter that is off this cpu for the moment leaves what it moved to a later stage
+    std::uint64_t now[PERF_EVENTS];
+    if (!read_counters(*c, now))
+        return previous;
+    if (c->synced && previous != PerfStage::none)
+        for (int e = 0; e < PERF_EVENTS; e++)
+            totals[(int)previous][e].fetch_add(now[e] - c->last[e], std::memory_order_relaxed);
+    for (int e = 0; e < PERF_EVENTS; e++)
+        c->last[e] = now[e];
+    c->synced = true;
+    return previous;
+}
+
+PerfStats perf_stats() {
+    PerfStats s;
+    s.available = threads_open.load(std::memory_order_relaxed) > 0;
+    s.error = first_error.load(std::memory_order_relaxed);
+    s.staged = s.available && !unstaged.load(std::memory_order_relaxed);
+    s.blocks = blocks.load(std::memory_order_relaxed);
+    if (s.staged) {
+        for (int st = 0; st < PERF_STAGES; st++)
+            for (int e = 0; e < PERF_EVENTS; e++) {
+                s.counts[st][e] = totals[st][e].load(std::memory_order_relaxed);
+                s.total[e] += s.counts[st][e];
+            }
+        return s;
+    }
+    // whole threads since the reset, read here rather than on the threads themselves
+    for (const ThreadCounters& c : slots) {
+        std::uint64_t now[PERF_EVENTS];
+        if (c.open.load(std::memory_order_acquire) && read_group(c, now))
+            for (int e = 0; e < PERF_EVENTS; e++)
+                s.total[e] += now[e] - c.base[e];
+    }
+    return s;
+}
+
+void perf_report(FILE* out, const PerfStats& s) {
+    if (!s.available) {
+        fprintf(out, "perf counters unavailable: %s\n", s.error ? strerror(s.error) : "not enabled");
+        return;
+    }
+    const double blocks_ = (double)(s.blocks ? s.blocks : 1);
+    fprintf(out, "perf counters over %llu blocks, per block:\n", (unsigned long long)s.blocks);
+    if (!s.staged)
+        fprintf(out, "no rdpmc, so whole render threads only, idle spinning included\n");
+    fprintf(out, "%-12s %12s %12s %6s %14s %14s %14s\n", "stage", "cycles", "instructions", "ipc",
+        "L1D miss/kinst", "LLC miss/kinst", "br miss/kinst");
+    for (int st = s.staged ? 0 : PERF_STAGES; st <= PERF_STAGES; st++) {
+        const std::uint64_t* c = (st < PERF_STAGES) ? s.counts[st] : s.total;
+        const double kinst = c[(int)PerfEvent::instructions] / 1000.0;
+        const auto rate = [&](PerfEvent e) { return kinst > 0 ? c[(int)e] / kinst : 0.0; };
+        fprintf(out, "%-12s %12.0f %12.0f %6.2f %14.2f %14.3f %14.2f\n", st < PERF_STAGES ? PERF_STAGE_NAMES[st] : "block",
+            c[(int)PerfEvent::cycles] / blocks_, c[(int)PerfEvent::instructions] / blocks_,
+            c[(int)PerfEvent::cycles] ? (double)c[(int)PerfEvent::instructions] / c[(int)PerfEvent::cycles] : 0.0,
+            rate(PerfEvent::l1d_misses), rate(PerfEvent::llc_misses), rate(PerfEvent::branch_misses));
+    }
+}
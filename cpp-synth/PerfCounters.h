@@ -0,0 +1,73 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+
+// Hardware counters split by render stage, opt-in. Each thread that renders registers itself, and
+// the control thread opens a group of perf_event counters for every registered thread, so no render
+// thread ever makes the syscalls. A PerfScope charges what the counters moved to the stage it was in,
+// read with rdpmc. Where the kernel does not allow rdpmc the stages are not split and the control
+// thread reads whole thread totals instead. Linux only, elsewhere the counters never open.
+enum class PerfEvent { cycles, instructions, l1d_misses, llc_misses, branch_misses };
+constexpr const char* PERF_EVENT_NAMES[] = { "cycles", "instructions", "L1D misses", "LLC misses", "branch misses" };
+constexpr auto PERF_EVENTS = 5;
+
+// other is the audio thread's time in a block outside the rest, none is not counted
+enum class PerfStage { other, envelopes, oscillators, mix, patch, output, none };
+constexpr const char* PERF_STAGE_NAMES[] = { "other", "envelopes", "oscillators", "mix", "patch", "output" };
+constexpr auto PERF_STAGES = 6;
+
+// threads that can be counted, later ones are not
+constexpr auto PERF_THREADS = 32;
+
+struct PerfStats
+{
+    // some thread has its counters open
+    bool          available = false;
+    // errno of the first open that failed, 0 when none has
+    int           error     = 0;
+    // every counting thread reads with rdpmc, so counts holds the stages; otherwise only total is
+    // known, for the render threads as a whole including idle spinning
+    bool          staged    = false;
+    std::uint64_t blocks    = 0;
+    std::uint64_t counts[PERF_STAGES][PERF_EVENTS]{};
+    std::uint64_t total[PERF_EVENTS]{};
+};
+
+// each thread that renders, before its first block; the first call takes the thread id and a slot,
+// later ones return at once
+void      perf_register_thread();
+// control thread; turning counting on also opens the counters of the threads registered so far
+void      perf_enable(bool on);
+bool      perf_enabled();
+// control thread, opens the counters of threads registered since the last call; cheap when there are none
+void      perf_open_threads();
+// a rendered block, for the per block figures
+void      perf_count_block();
+// control thread
+void      perf_reset();
+PerfStats perf_stats();
+// per block counts and miss rates of each stage
+void      perf_report(FILE* out, const PerfStats& stats);
+// charges the counters so far to the thread's current stage and moves it to stage, returns the one it left
+PerfStage perf_switch(PerfStage stage);
+
+// the enclosed code is charged to stage, the enclosing stage picks up again afterwards
+class PerfScope
+{
+private:
+    PerfStage previous = PerfStage::none;
+    bool      active;
+public:
+    explicit PerfScope(PerfStage stage) : active(perf_enabled())
+    {
+        if (active)
+            previous = perf_switch(stage);
+    }
+    ~PerfScope()
+    {
+        if (active)
+            perf_switch(previous);
+    }
+    PerfScope(const PerfScope&) = delete;
+    PerfScope& operator=(const PerfScope&) = delete;
+};
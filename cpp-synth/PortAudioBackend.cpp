@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include "PortAudioBackend.h"
+#include "RtCheck.h"
+#include "Synth.h"
+#include "Trace.h"
+
+PortAudioBackend::PortAudioBackend(PaDeviceIndex device, unsigned long frames_per_buffer)
+    : device(device), frames_per_buffer(frames_per_buffer)
+{
+    sprintf(message, "Synth End ");
+}
+
+bool PortAudioBackend::open(Synth* synth_) {
+    PaStreamParameters outputParameters{ };
+
+    outputParameters.device = device;
+    if (outputParameters.device == paNoDevice || synth_ == 0) {
+        return false;
+    }
+    synth = synth_;
+
+    const PaDeviceInfo* pInfo = Pa_GetDeviceInfo(device);
+    if (pInfo != 0)
+    {
+        printf("Output device name: %s\r", pInfo->name);
+    }
+
+    outputParameters.channelCount = 2;
+    outputParameters.sampleFormat = paFloat32;
+    outputParameters.suggestedLatency = Pa_GetDeviceInfo(outputParameters.device)->defaultLowOutputLatency;
+    outputParameters.hostApiSpecificStreamInfo = NULL;
+
+    PaError err = Pa_OpenStream(&stream, NULL, &outputParameters, SAMPLE_RATE, frames_per_buffer, 0, &PortAudioBackend::paCallback, this);
+
+    if (err != paNoError)
+    {
+        return false;
+    }
+
+    err = Pa_SetStreamFinishedCallback(stream, &PortAudioBackend::paStreamFinished);
+
+    if (err != paNoError)
+    {
+        Pa_CloseStream(stream);
+        stream = 0;
+
+        return false;
+    }
+
+    return true;
+}
+
+bool PortAudioBackend::close() {
+    if (stream == 0)
+        return false;
+    PaError err = Pa_CloseStream(stream);
+    stream = 0;
+    return (err == paNoError);
+}
+
+bool PortAudioBackend::start() {
+    if (stream == 0)
+        return false;
+    PaError err = Pa_StartStream(stream);
+    return (err == paNoError);
+}
+
+bool PortAudioBackend::stop() {
+    if (stream == 0)
+        return false;
+    PaError err = Pa_StopStream(stream);
+    // reported here rather than from the callback thread, where printf can block
+    if (finished.exchange(false))
+        printf("Stream Completed: %s\n", message);
+    return (err == paNoError);
+}
+
+int PortAudioBackend::paCallbackMethod(const void* inputBuffer, 
+                            void* outputBuffer, 
+                            unsigned long framesPerBuffer, 
+                            const PaStreamCallbackTimeInfo* timeInfo, 
+                            PaStreamCallbackFlags statusFlags) {
+
+    (void)timeInfo;
+    (void)inputBuffer;
+
+    const std::uint64_t entered = timing_ticks();
+    rt_check_tag_thread();
+    trace_thread("audio");
+    {
+        TraceZone zone("callback");
+        synth->render((float*)outputBuffer, framesPerBuffer);
+    }
+    timing.record(entered, timing_ticks(), framesPerBuffer,
+        (statusFlags & paOutputUnderflow) != 0, (statusFlags & paOutputOverflow) != 0);
+    return paContinue;
+}
+
+int PortAudioBackend::paCallback(const void* inputBuffer, 
+                      void* outputBuffer, 
+                      unsigned long framesPerBuffer, 
+                      const PaStreamCallbackTimeInfo* timeInfo, 
+                      PaStreamCallbackFlags statusFlags, 
+                      void* userData) {
+
+    return ((PortAudioBackend*)userData)->paCallbackMethod(inputBuffer, 
+                                                outputBuffer,
+                                                framesPerBuffer,
+                                                timeInfo,
+                                                statusFlags);
+}
+
+void PortAudioBackend::paStreamFinishedMethod() {
+    finished.store(true);
+}
+
+void PortAudioBackend::paStreamFinished(void* userData) {
+    return ((PortAudioBackend*)userData)->paStreamFinishedMethod();
+}
+
+
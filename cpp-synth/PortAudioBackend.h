@@ -0,0 +1,53 @@
+#pragma once
+#include <atomic>
+#include "AudioBackend.h"
+#include "portaudio.h"
+
+class PortAudioBackend : public AudioBackend
+{
+private:
+    PaStream* stream{ 0 };
+    PaDeviceIndex device;
+    unsigned long frames_per_buffer;
+    Synth* synth{ 0 };
+    char message[20];
+    // set on the callback thread once the stream has drained
+    std::atomic<bool> finished{ false };
+    int paCallbackMethod(const void*, 
+                         void*, 
+                         unsigned long, 
+                         const PaStreamCallbackTimeInfo*, 
+                         PaStreamCallbackFlags);
+    static int paCallback(const void* inputBuffer, 
+                          void* outputBuffer, 
+                          unsigned long framesPerBuffer, 
+                          const PaStreamCallbackTimeInfo* timeInfo, 
+                          PaStreamCallbackFlags statusFlags, 
+                          void* userData);
+    void paStreamFinishedMethod();
+    static void paStreamFinished(void* userData);
+public:
+    explicit PortAudioBackend(PaDeviceIndex device, unsigned long frames_per_buffer = 512);
+    // closing aborts a stream that is still running
+    ~PortAudioBackend() override { close(); }
+    bool open(Synth* synth) override;
+    bool close() override;
+    bool start() override;
+    bool stop() override;
+    unsigned long block_size() const override { return frames_per_buffer; }
+};
+
+class ScopedPaHandler {
+public:
+    ScopedPaHandler() : _result(Pa_Initialize()) {}
+    ~ScopedPaHandler()
+    {
+        if (_result == paNoError)
+        {
+            Pa_Terminate();
+        }
+    }
+    PaError result() const { return _result; }
+private:
+    PaError _result;
+};
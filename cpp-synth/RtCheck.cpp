@@ -0,0 +1,408 @@
+// the hooks below define printf and read themselves, which the fortified inline wrappers would clash with
+#undef _FORTIFY_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <execinfo.h>
+#include <poll.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include "RtCheck.h"
+
+#ifndef SYNTH_RT_CHECK
+#error "RtCheck.cpp is only built with the SYNTH_RT_CHECK option, which defines SYNTH_RT_CHECK"
+#endif
+
+// Linux and glibc only. The functions below replace the libc ones for the whole program and forward
+// to the real ones, glibc's __libc_ allocator entry points or whatever dlsym(RTLD_NEXT) finds.
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* block, size_t size);
+void  __libc_free(void* block);
+void* __libc_memalign(size_t alignment, size_t size);
+}
+
+namespace {
+
+constexpr auto TRACE_DEPTH = 24;
+// distinct backtraces kept, later ones are only counted
+constexpr auto TRACE_SLOTS = 16;
+// frames of the checker itself, left off the printed backtraces so they start at the call
+constexpr auto TRACE_SKIP = 2;
+
+struct Trace
+{
+    std::atomic<bool>        ready{ false };
+    std::atomic<std::size_t> hits{ 0 };
+    RtViolation              kind = RtViolation::allocation;
+    const char*              what = "";
+    int                      depth = 0;
+    void*                    frames[TRACE_DEPTH]{};
+};
+
+thread_local bool tagged = false;
+thread_local int  scopes = 0;
+// inside a hook already, so the libc calls the hook makes itself are not counted again
+thread_local bool hooked = false;
+
+std::atomic<std::size_t> counts[RT_VIOLATION_KINDS];
+Trace                    traces[TRACE_SLOTS];
+std::atomic<int>         trace_count{ 0 };
+
+__attribute__((noinline)) void record(RtViolation kind, const char* what) {
+    counts[(int)kind].fetch_add(1, std::memory_order_relaxed);
+    void* frames[TRACE_DEPTH];
+    const int depth = backtrace(frames, TRACE_DEPTH);
+    const int known = std::min(trace_count.load(std::memory_order_acquire), TRACE_SLOTS);
+    for (int i = 0; i < known; i++) {
+        Trace& t = traces[i];
+        if (t.ready.load(std::memory_order_acquire) && t.what == what && t.depth == depth &&
+            memcmp(t.frames, frames, depth * sizeof(void*)) == 0) {
+            t.hits.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+    const int slot = trace_count.fetch_add(1, std::memory_order_acq_rel);
+    if (slot >= TRACE_SLOTS)
+        return;
+    Trace& t = traces[slot];
+    t.kind = kind;
+    t.what = what;
+    t.depth = depth;
+    memcpy(t.frames, frames, depth * sizeof(void*));
+    t.hits.store(1, std::memory_order_relaxed);
+    t.ready.store(true, std::memory_order_release);
+}
+
+// one per hooked call, counts it when made on an audio thread from outside another hook
+class Hook
+{
+private:
+    bool outer;
+public:
+    __attribute__((noinline)) Hook(RtViolation kind, const char* what) : outer(!hooked) {
+        if (!outer)
+            return;
+        hooked = true;
+        if (tagged || scopes > 0)
+            record(kind, what);
+    }
+    ~Hook() {
+        if (outer)
+            hooked = false;
+    }
+};
+
+void* resolve(const char* name, std::atomic<void*>& slot) {
+    void* fn = slot.load(std::memory_order_relaxed);
+    if (fn == nullptr) {
+        fn = dlsym(RTLD_NEXT, name);
+        slot.store(fn, std::memory_order_relaxed);
+    }
+    return fn;
+}
+
+// the next definition of a libc function, looked up once
+#define RT_REAL(fn) ([] { static std::atomic<void*> slot{ nullptr }; return reinterpret_cast<decltype(&fn)>(resolve(#fn, slot)); }())
+
+__attribute__((constructor)) void rt_check_setup() {
+    // backtrace() loads the unwinder on first use, which allocates, so get that done here
+    void* frames[1];
+    backtrace(frames, 1);
+    atexit([] { rt_check_report(stderr); });
+}
+
+} // namespace
+
+void rt_check_tag_thread() {
+    tagged = true;
+}
+
+void rt_check_enter() {
+    scopes++;
+}
+
+void rt_check_leave() {
+    scopes--;
+}
+
+std::size_t rt_check_count(RtViolation kind) {
+    return counts[(int)kind].load(std::memory_order_relaxed);
+}
+
+std::size_t rt_check_total() {
+    std::size_t total = 0;
+    for (int k = 0; k < RT_VIOLATION_KINDS; k++)
+        total += rt_check_count((RtViolation)k);
+    return total;
+}
+
+void rt_check_report(FILE* out) {
+    const std::size_t total = rt_check_total();
+    fprintf(out, "rt check: %zu calls on the audio thread", total);
+    for (int k = 0; k < RT_VIOLATION_KINDS; k++)
+        fprintf(out, "%s%s %zu", k ? ", " : " (", RT_VIOLATION_NAMES[k], rt_check_count((RtViolation)k));
+    fprintf(out, ")\n");
+    const int known = std::min(trace_count.load(std::memory_order_acquire), TRACE_SLOTS);
+    for (int i = 0; i < known; i++) {
+        const Trace& t = traces[i];
+        if (!t.ready.load(std::memory_order_acquire))
+            continue;
+        fprintf(out, "#%d %s %s, %zu times\n", i + 1, RT_VIOLATION_NAMES[(int)t.kind], t.what, t.hits.load(std::memory_order_relaxed));
+        fflush(out);
+        if (t.depth > TRACE_SKIP)
+            backtrace_symbols_fd(t.frames + TRACE_SKIP, t.depth - TRACE_SKIP, fileno(out));
+    }
+    if (trace_count.load(std::memory_order_relaxed) > TRACE_SLOTS)
+        fprintf(out, "more call sites than the %d kept\n", TRACE_SLOTS);
+    fflush(out);
+}
+
+// allocation
+
+extern "C" void* malloc(size_t size) noexcept {
+    Hook hook(RtViolation::allocation, "malloc");
+    return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t count, size_t size) noexcept {
+    Hook hook(RtViolation::allocation, "calloc");
+    return __libc_calloc(count, size);
+}
+
+extern "C" void* realloc(void* block, size_t size) noexcept {
+    Hook hook(RtViolation::allocation, "realloc");
+    return __libc_realloc(block, size);
+}
+
+extern "C" void free(void* block) noexcept {
+    if (block == nullptr)
+        return;
+    Hook hook(RtViolation::allocation, "free");
+    __libc_free(block);
+}
+
+extern "C" void* memalign(size_t alignment, size_t size) noexcept {
+    Hook hook(RtViolation::allocation, "memalign");
+    return __libc_memalign(alignment, size);
+}
+
+extern "C" void* aligned_alloc(size_t alignment, size_t size) noexcept {
+    Hook hook(RtViolation::allocation, "aligned_alloc");
+    return __libc_memalign(alignment, size);
+}
+
+extern "C" int posix_memalign(void** block, size_t alignment, size_t size) noexcept {
+    Hook hook(RtViolation::allocation, "posix_memalign");
+    if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0)
+        return EINVAL;
+    void* p = __libc_memalign(alignment, size);
+    if (p == nullptr)
+        return ENOMEM;
+    *block = p;
+    return 0;
+}
+
+// the aligned and nothrow forms of new and delete come down to these or to the C allocator
+
+void* operator new(std::size_t size) {
+    Hook hook(RtViolation::allocation, "operator new");
+    void* p = __libc_malloc(size ? size : 1);
+    if (p == nullptr)
+        throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](std::size_t size) {
+    Hook hook(RtViolation::allocation, "operator new[]");
+    void* p = __libc_malloc(size ? size : 1);
+    if (p == nullptr)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* block) noexcept {
+    if (block == nullptr)
+        return;
+    Hook hook(RtViolation::allocation, "operator delete");
+    __libc_free(block);
+}
+
+void operator delete[](void* block) noexcept {
+    if (block == nullptr)
+        return;
+    Hook hook(RtViolation::allocation, "operator delete[]");
+    __libc_free(block);
+}
+
+void operator delete(void* block, std::size_t) noexcept {
+    operator delete(block);
+}
+
+void operator delete[](void* block, std::size_t) noexcept {
+    operator delete[](block);
+}
+
+// locks
+
+extern "C" int pthread_mutex_lock(pthread_mutex_t* mutex) noexcept {
+    Hook hook(RtViolation::lock, "pthread_mutex_lock");
+    return RT_REAL(pthread_mutex_lock)(mutex);
+}
+
+extern "C" int pthread_rwlock_rdlock(pthread_rwlock_t* lock) noexcept {
+    Hook hook(RtViolation::lock, "pthread_rwlock_rdlock");
+    return RT_REAL(pthread_rwlock_rdlock)(lock);
+}
+
+extern "C" int pthread_rwlock_wrlock(pthread_rwlock_t* lock) noexcept {
+    Hook hook(RtViolation::lock, "pthread_rwlock_wrlock");
+    return RT_REAL(pthread_rwlock_wrlock)(lock);
+}
+
+// stdio, which takes the stream lock and may write
+
+extern "C" int vfprintf(FILE* stream, const char* format, va_list args) {
+    Hook hook(RtViolation::stdio, "vfprintf");
+    return RT_REAL(vfprintf)(stream, format, args);
+}
+
+extern "C" int vprintf(const char* format, va_list args) {
+    Hook hook(RtViolation::stdio, "vprintf");
+    return RT_REAL(vfprintf)(stdout, format, args);
+}
+
+extern "C" int fprintf(FILE* stream, const char* format, ...) {
+    Hook hook(RtViolation::stdio, "fprintf");
+    va_list args;
+    va_start(args, format);
+    const int n = RT_REAL(vfprintf)(stream, format, args);
+    va_end(args);
+    return n;
+}
+
+extern "C" int printf(const char* format, ...) {
+    Hook hook(RtViolation::stdio, "printf");
+    va_list args;
+    va_start(args, format);
+    const int n = RT_REAL(vfprintf)(stdout, format, args);
+    va_end(args);
+    return n;
+}
+
+// what fortified builds turn printf and fprintf into
+extern "C" int __printf_chk(int, const char* format, ...) {
+    Hook hook(RtViolation::stdio, "printf");
+    va_list args;
+    va_start(args, format);
+    const int n = RT_REAL(vfprintf)(stdout, format, args);
+    va_end(args);
+    return n;
+}
+
+extern "C" int __fprintf_chk(FILE* stream, int, const char* format, ...) {
+    Hook hook(RtViolation::stdio, "fprintf");
+    va_list args;
+    va_start(args, format);
+    const int n = RT_REAL(vfprintf)(stream, format, args);
+    va_end(args);
+    return n;
+}
+
+extern "C" int puts(const char* text) {
+    Hook hook(RtViolation::stdio, "puts");
+    return RT_REAL(puts)(text);
+}
+
+extern "C" int fputs(const char* text, FILE* stream) {
+    Hook hook(RtViolation::stdio, "fputs");
+    return RT_REAL(fputs)(text, stream);
+}
+
+extern "C" int putchar(int c) {
+    Hook hook(RtViolation::stdio, "putchar");
+    return RT_REAL(putchar)(c);
+}
+
+extern "C" size_t fwrite(const void* data, size_t size, size_t count, FILE* stream) {
+    Hook hook(RtViolation::stdio, "fwrite");
+    return RT_REAL(fwrite)(data, size, count, stream);
+}
+
+extern "C" int fflush(FILE* stream) {
+    Hook hook(RtViolation::stdio, "fflush");
+    return RT_REAL(fflush)(stream);
+}
+
+// syscalls that can block
+
+extern "C" ssize_t read(int fd, void* data, size_t size) {
+    Hook hook(RtViolation::blocking, "read");
+    return RT_REAL(read)(fd, data, size);
+}
+
+extern "C" ssize_t write(int fd, const void* data, size_t size) {
+    Hook hook(RtViolation::blocking, "write");
+    return RT_REAL(write)(fd, data, size);
+}
+
+extern "C" int nanosleep(const struct timespec* duration, struct timespec* left) {
+    Hook hook(RtViolation::blocking, "nanosleep");
+    return RT_REAL(nanosleep)(duration, left);
+}
+
+extern "C" int clock_nanosleep(clockid_t clock, int flags, const struct timespec* duration, struct timespec* left) {
+    Hook hook(RtViolation::blocking, "clock_nanosleep");
+    return RT_REAL(clock_nanosleep)(clock, flags, duration, left);
+}
+
+extern "C" int usleep(useconds_t us) {
+    Hook hook(RtViolation::blocking, "usleep");
+    return RT_REAL(usleep)(us);
+}
+
+extern "C" unsigned int sleep(unsigned int seconds) {
+    Hook hook(RtViolation::blocking, "sleep");
+    return RT_REAL(sleep)(seconds);
+}
+
+extern "C" int poll(struct pollfd* fds, nfds_t count, int timeout) {
+    Hook hook(RtViolation::blocking, "poll");
+    return RT_REAL(poll)(fds, count, timeout);
+}
+
+extern "C" int select(int count, fd_set* readable, fd_set* writable, fd_set* failed, struct timeval* timeout) {
+    Hook hook(RtViolation::blocking, "select");
+    return RT_REAL(select)(count, readable, writable, failed, timeout);
+}
+
+extern "C" int sem_wait(sem_t* sem) {
+    Hook hook(RtViolation::blocking, "sem_wait");
+    return RT_REAL(sem_wait)(sem);
+}
+
+extern "C" int pthread_cond_wait(pthread_cond_t* cond, pthread_mutex_t* mutex) {
+    Hook hook(RtViolation::blocking, "pthread_cond_wait");
+    return RT_REAL(pthread_cond_wait)(cond, mutex);
+}
+
+extern "C" int pthread_cond_timedwait(pthread_cond_t* cond, pthread_mutex_t* mutex, const struct timespec* until) {
+    Hook hook(RtViolation::blocking, "pthread_cond_timedwait");
+    return RT_REAL(pthread_cond_timedwait)(cond, mutex, until);
+}
+
+extern "C" int pthread_join(pthread_t thread, void** result) {
+    Hook hook(RtViolation::blocking, "pthread_join");
+    return RT_REAL(pthread_join)(thread, result);
+}
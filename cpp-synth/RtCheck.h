@@ -0,0 +1,38 @@
+#pragma once
+#include <cstddef>
+#include <cstdio>
+
+// Realtime-safety checker, built in with the SYNTH_RT_CHECK cmake option. A thread is an audio thread
+// while it is tagged, for the rest of its life or for an RtScope, and every allocation, lock, stdio
+// call or blocking syscall it makes is counted, the first few call sites with a backtrace. The report
+// goes to stderr at exit. Without the option everything here compiles away.
+enum class RtViolation { allocation, lock, stdio, blocking };
+constexpr const char* RT_VIOLATION_NAMES[] = { "allocation", "lock", "stdio", "blocking" };
+constexpr auto RT_VIOLATION_KINDS = 4;
+
+#ifdef SYNTH_RT_CHECK
+// the calling thread is an audio thread until it exits
+void        rt_check_tag_thread();
+// scopes nest, the thread is an audio thread while any is open
+void        rt_check_enter();
+void        rt_check_leave();
+std::size_t rt_check_count(RtViolation kind);
+std::size_t rt_check_total();
+void        rt_check_report(FILE* out);
+#else
+inline void        rt_check_tag_thread() {}
+inline void        rt_check_enter() {}
+inline void        rt_check_leave() {}
+inline std::size_t rt_check_count(RtViolation) { return 0; }
+inline std::size_t rt_check_total() { return 0; }
+inline void        rt_check_report(FILE*) {}
+#endif
+
+// marks the code of one callback as running on the audio thread
+struct RtScope
+{
+    RtScope() { rt_check_enter(); }
+    ~RtScope() { rt_check_leave(); }
+    RtScope(const RtScope&) = delete;
+    RtScope& operator=(const RtScope&) = delete;
+};
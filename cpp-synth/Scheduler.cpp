@@ -0,0 +1,246 @@
+#include <chrono>
+#include "PerfCounters.h"
+#include "RtCheck.h"
+#include "Scheduler.h"
+#include "Trace.h"
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#endif
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace {
+    // polls before an idle worker parks, a few tens of microseconds
+    constexpr int SPIN_POLLS = 20000;
+
+    inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+        _mm_pause();
+#endif
+    }
+
+    std::size_t power_of_two_above(std::size_t n) {
+        std::size_t p = 1;
+        while (p < n)
+            p <<= 1;
+        return p;
+    }
+}
+
+TaskGraph::TaskGraph(std::size_t capacity) {
+    reserve(capacity);
+}
+
+void TaskGraph::reserve(std::size_t capacity) {
+    nodes = std::make_unique<TaskNode[]>(capacity);
+    capacity_ = capacity;
+    count = 0;
+}
+
+int TaskGraph::add(TaskNode::Fn fn, void* context, std::size_t arg, const char* name) {
+    if (count >= capacity_)
+        return -1;
+    TaskNode& n = nodes[count];
+    n.fn = fn;
+    n.context = context;
+    n.arg = arg;
+    n.name = name;
+    n.successor_count = 0;
+    n.dependencies = 0;
+    return (int)count++;
+}
+
+bool TaskGraph::depend(int before, int after) {
+    TaskNode& n = nodes[before];
+    if (n.successor_count >= MAX_SUCCESSORS)
+        return false;
+    n.successors[n.successor_count++] = after;
+    nodes[after].dependencies++;
+    return true;
+}
+
+void TaskGraph::reset_timing() {
+    for (std::size_t i = 0; i < capacity_; i++) {
+        nodes[i].last_ns.store(0, std::memory_order_relaxed);
+        nodes[i].max_ns.store(0, std::memory_order_relaxed);
+        nodes[i].total_ns.store(0, std::memory_order_relaxed);
+        nodes[i].runs.store(0, std::memory_order_relaxed);
+    }
+}
+
+void TaskDeque::reserve(std::size_t capacity) {
+    const std::size_t size = power_of_two_above(capacity);
+    items = std::make_unique<std::atomic<int>[]>(size);
+    mask = (std::int64_t)size - 1;
+    reset();
+}
+
+void TaskDeque::push(int node) {
+    const std::int64_t b = bottom.load(std::memory_order_relaxed);
+    // release on the item too, so a thief that takes it sees everything done before the push
+    items[b & mask].store(node, std::memory_order_release);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom.store(b + 1, std::memory_order_relaxed);
+}
+
+bool TaskDeque::pop(int& node) {
+    const std::int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+    bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    std::int64_t t = top.load(std::memory_order_relaxed);
+    if (t > b) {
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return false;
+    }
+    node = items[b & mask].load(std::memory_order_relaxed);
+    if (t == b) {
+        // last item, race the thieves for it
+        const bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return won;
+    }
+    return true;
+}
+
+bool TaskDeque::steal(int& node) {
+    std::int64_t t = top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const std::int64_t b = bottom.load(std::memory_order_acquire);
+    if (t >= b)
+        return false;
+    node = items[t & mask].load(std::memory_order_acquire);
+    return top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+}
+
+Scheduler::Scheduler(std::size_t workers, bool spin_, bool pin)
+    : deques(workers + 1), spin(spin_)
+{
+    const int cpus = (int)std::thread::hardware_concurrency();
+    threads.reserve(workers);
+    for (std::size_t t = 1; t <= workers; t++)
+        threads.emplace_back(&Scheduler::worker, this, t, (pin && cpus > 0) ? (int)(t % cpus) : -1);
+}
+
+Scheduler::~Scheduler() {
+    stopping.store(true);
+    generation.fetch_add(1, std::memory_order_release);
+    generation.notify_all();
+    for (auto& t : threads)
+        t.join();
+}
+
+void Scheduler::reserve(std::size_t nodes) {
+    for (auto& d : deques)
+        d.reserve(nodes);
+}
+
+void Scheduler::run_node(TaskGraph& g, int index, std::size_t thread) {
+    using clock = std::chrono::steady_clock;
+    TaskNode& n = g.node(index);
+    const auto started = clock::now();
+    {
+        TraceZone zone(n.name);
+        n.fn(n.context, n.arg, thread);
+    }
+    const std::uint64_t ns = (std::uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - started).count();
+    n.last_ns.store(ns, std::memory_order_relaxed);
+    n.total_ns.store(n.total_ns.load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+    n.runs.store(n.runs.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    if (ns > n.max_ns.load(std::memory_order_relaxed))
+        n.max_ns.store(ns, std::memory_order_relaxed);
+
+    for (int s = 0; s < n.successor_count; s++) {
+        const int next = n.successors[s];
+        if (g.node(next).pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            deques[thread].push(next);
+    }
+    remaining.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+bool Scheduler::steal(std::size_t thread, int& node) {
+    for (std::size_t k = 1; k < deques.size(); k++)
+        if (deques[(thread + k) % deques.size()].steal(node))
+            return true;
+    return false;
+}
+
+void Scheduler::execute(TaskGraph& g, std::size_t thread) {
+    int node;
+    while (remaining.load(std::memory_order_acquire) > 0) {
+        if (deques[thread].pop(node) || steal(thread, node))
+            run_node(g, node, thread);
+        else
+            cpu_relax();
+    }
+}
+
+void Scheduler::worker(std::size_t thread, int cpu) {
+#ifdef __linux__
+    if (cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+#else
+    (void)cpu;
+#endif
+    trace_thread("render worker", (int)thread);
+    perf_register_thread();
+    std::uint32_t seen = generation.load(std::memory_order_acquire);
+    int idle = 0;
+    while (!stopping.load(std::memory_order_relaxed)) {
+        // join, then check the run is still going, the caller waits for everyone who joined
+        if (remaining.load(std::memory_order_seq_cst) > 0) {
+            joined.fetch_add(1, std::memory_order_seq_cst);
+            if (remaining.load(std::memory_order_seq_cst) > 0) {
+                RtScope rt;
+                execute(*graph.load(std::memory_order_acquire), thread);
+            }
+            joined.fetch_sub(1, std::memory_order_seq_cst);
+            idle = 0;
+            continue;
+        }
+        const std::uint32_t now = generation.load(std::memory_order_acquire);
+        if (now != seen) {
+            seen = now;
+            idle = 0;
+            continue;
+        }
+        if (spin || ++idle < SPIN_POLLS) {
+            cpu_relax();
+            continue;
+        }
+        generation.wait(seen, std::memory_order_acquire);
+        seen = generation.load(std::memory_order_acquire);
+        idle = 0;
+    }
+}
+
+void Scheduler::run(TaskGraph& g) {
+    if (g.size() == 0)
+        return;
+    // nobody is inside a run here, so the deques and counters can be set up plainly
+    for (auto& d : deques)
+        d.reset();
+    std::size_t roots = 0;
+    for (std::size_t i = 0; i < g.size(); i++) {
+        TaskNode& n = g.node(i);
+        n.pending.store(n.dependencies, std::memory_order_relaxed);
+        if (n.dependencies == 0)
+            deques[roots++ % deques.size()].push((int)i);
+    }
+    graph.store(&g, std::memory_order_relaxed);
+    remaining.store(g.size(), std::memory_order_seq_cst);
+    if (!threads.empty()) {
+        generation.fetch_add(1, std::memory_order_release);
+        if (!spin)
+            generation.notify_all();
+    }
+
+    execute(g, 0);
+    while (joined.load(std::memory_order_seq_cst) > 0)
+        cpu_relax();
+}
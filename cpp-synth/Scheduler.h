@@ -0,0 +1,105 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// edges out of one node, enough for a mixer input fanning out to sends
+constexpr auto MAX_SUCCESSORS = 8;
+
+// One unit of DSP work in a TaskGraph, with its timing from the runs so far
+struct TaskNode
+{
+    using Fn = void (*)(void* context, std::size_t arg, std::size_t thread);
+    Fn          fn               = nullptr;
+    void*       context          = nullptr;
+    std::size_t arg              = 0;
+    const char* name             = "";
+    int         successors[MAX_SUCCESSORS]{};
+    int         successor_count  = 0;
+    int         dependencies     = 0;
+    std::atomic<int> pending{ 0 };
+    // nanoseconds, written by whichever thread ran the node and readable from any
+    std::atomic<std::uint64_t> last_ns{ 0 };
+    std::atomic<std::uint64_t> max_ns{ 0 };
+    std::atomic<std::uint64_t> total_ns{ 0 };
+    std::atomic<std::uint64_t> runs{ 0 };
+};
+
+// DAG of DSP nodes with a fixed capacity, so it can be rebuilt on the audio thread every block.
+// Timing stays with the node index across clear(), for graphs rebuilt in the same shape.
+class TaskGraph
+{
+private:
+    std::unique_ptr<TaskNode[]> nodes;
+    std::size_t count{ 0 };
+    std::size_t capacity_{ 0 };
+public:
+    explicit TaskGraph(std::size_t capacity = 0);
+    // drops every node, and their timing, not on the audio thread
+    void reserve(std::size_t capacity);
+    void clear() { count = 0; }
+    // index of the new node, -1 when the graph is full
+    int  add(TaskNode::Fn fn, void* context, std::size_t arg, const char* name);
+    // after runs once before has finished, false when before has no room for another edge
+    bool depend(int before, int after);
+    void reset_timing();
+    std::size_t size() const { return count; }
+    std::size_t capacity() const { return capacity_; }
+    TaskNode& node(std::size_t i) { return nodes[i]; }
+    const TaskNode& node(std::size_t i) const { return nodes[i]; }
+};
+
+// Bounded Chase-Lev deque of node indices. The owner pushes and pops at the bottom, other threads
+// steal from the top. Sized for a whole graph, so it never grows.
+class TaskDeque
+{
+private:
+    std::atomic<std::int64_t> top{ 0 };
+    std::atomic<std::int64_t> bottom{ 0 };
+    std::unique_ptr<std::atomic<int>[]> items;
+    std::int64_t mask{ 0 };
+public:
+    void reserve(std::size_t capacity);
+    void reset() { top.store(0, std::memory_order_relaxed); bottom.store(0, std::memory_order_relaxed); }
+    void push(int node);
+    bool pop(int& node);
+    bool steal(int& node);
+};
+
+// Work-stealing executor for a TaskGraph, called from the audio thread once per block. The caller
+// takes part as thread 0. Ready nodes go on the deque of the thread that readied them and idle
+// threads steal. Idle workers spin for a while and then park on the generation counter (a futex
+// on Linux), or keep spinning when spin is set. No locks or allocation inside run().
+class Scheduler
+{
+private:
+    std::vector<std::thread> threads;
+    std::vector<TaskDeque>   deques;
+    std::atomic<TaskGraph*>  graph{ nullptr };
+    // nodes of the current run not finished yet, zero between runs
+    std::atomic<std::size_t> remaining{ 0 };
+    // workers inside the current run
+    std::atomic<int>         joined{ 0 };
+    std::atomic<std::uint32_t> generation{ 0 };
+    std::atomic<bool>        stopping{ false };
+    bool                     spin;
+    void                     worker(std::size_t thread, int cpu);
+    void                     execute(TaskGraph& g, std::size_t thread);
+    void                     run_node(TaskGraph& g, int node, std::size_t thread);
+    bool                     steal(std::size_t thread, int& node);
+public:
+    // pin puts worker i on cpu i, leaving cpu 0 to the audio thread (Linux only)
+    Scheduler(std::size_t workers, bool spin = false, bool pin = false);
+    ~Scheduler();
+    Scheduler(const Scheduler&) = delete;
+    Scheduler& operator=(const Scheduler&) = delete;
+    // threads that can run nodes, including the caller
+    std::size_t concurrency() const { return threads.size() + 1; }
+    // deques sized for graphs up to this many nodes, not while running
+    void reserve(std::size_t nodes);
+    // runs every node of the graph in dependency order and returns when all have finished
+    void run(TaskGraph& g);
+};
@@ -0,0 +1,55 @@
+#include <algorithm>
+#include <cmath>
+#include "Smoothed.h"
+
+void Smoothed::configure(Smoothing mode_, float ramp_ms) {
+    mode = mode_;
+    length = (unsigned)ms_to_samples(std::max(ramp_ms, 0.0f));
+    // the one-pole glide is within 0.1% after the ramp, seven time constants
+    const float pole = length > 0 ? std::exp(-7.0f / length) : 0.0f;
+    float p = 1.0f;
+    for (auto& c : curve)
+        c = (p *= pole);
+    reset(target);
+    primed = false;
+}
+
+void Smoothed::reset(float value) {
+    current = target = value;
+    remaining = 0;
+    primed = true;
+}
+
+void Smoothed::set(float value) {
+    if (!primed || length == 0) {
+        reset(value);
+        return;
+    }
+    if (value == target)
+        return;
+    target = value;
+    remaining = length;
+    step = (target - current) / length;
+}
+
+bool Smoothed::ramp(float* out, unsigned long frames) {
+    if (remaining == 0)
+        return false;
+    if (mode == Smoothing::linear) {
+        const unsigned long moving = std::min<unsigned long>(frames, remaining);
+        const float from = current;
+        for (unsigned long i = 0; i < moving; i++)
+            out[i] = from + step * (float)(i + 1);
+        std::fill(out + moving, out + frames, target);
+        remaining -= (unsigned)moving;
+        current = remaining > 0 ? from + step * (float)moving : target;
+    }
+    else {
+        const float delta = current - target;
+        for (unsigned long i = 0; i < frames; i++)
+            out[i] = target + delta * curve[i];
+        remaining = remaining > frames ? remaining - (unsigned)frames : 0;
+        current = remaining > 0 ? target + delta * curve[frames - 1] : target;
+    }
+    return true;
+}
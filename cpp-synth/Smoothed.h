@@ -0,0 +1,35 @@
+#pragma once
+#include "wavetable.h"
+
+enum class Smoothing { linear, one_pole };
+constexpr const char* SMOOTHING_NAMES[] = { "linear", "one_pole" };
+constexpr auto DEFAULT_SMOOTHING_MS = 20.0f;
+
+// A control that glides to a new value instead of stepping to it. set() takes the target once per
+// block, ramp() writes the block's worth of the glide. Once it has arrived ramp() writes nothing and
+// returns false, so a control that is not moving costs nothing per sample.
+class Smoothed
+{
+private:
+    Smoothing mode      = Smoothing::linear;
+    unsigned  length    = 0;
+    float     current   = 0.0f;
+    float     target    = 0.0f;
+    float     step      = 0.0f;
+    unsigned  remaining = 0;
+    bool      primed    = false;
+    // pole^(i + 1), so a one-pole block is a multiply-add per frame like the linear one
+    float     curve[MAX_BLOCK_SIZE]{};
+public:
+    // linear moves in a straight line over the ramp, one_pole closes in exponentially and snaps to the
+    // target at its end. Not while ramp() can run.
+    void  configure(Smoothing mode, float ramp_ms);
+    // jumps straight to value
+    void  reset(float value);
+    // glides to value from wherever it is, the first value it is given is jumped to
+    void  set(float value);
+    float value() const   { return current; }
+    bool  settled() const { return remaining == 0; }
+    // the next frames of the glide, false without touching out once settled
+    bool  ramp(float* out, unsigned long frames);
+};
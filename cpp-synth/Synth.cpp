@@ -1,126 +1,365 @@
+#include <algorithm>
+#include "PerfCounters.h"
+#include "RtCheck.h"
 #include "Synth.h"
+#include "Trace.h"
 #include "wavetable.h"
 
 Synth::Synth() 
 {
-     sprintf(message, "Synth End ");
      oscA.label = 'A';
      oscB.label = 'B';
      oscC.label = 'C';
+     scheduler = std::make_unique<Scheduler>(0);
+     publish_patch(default_patch());
+     set_smoothing(Smoothing::linear, DEFAULT_SMOOTHING_MS);
 }
 
-bool Synth::open(PaDeviceIndex index) {
-    PaStreamParameters outputParameters{ };
+void Synth::allocate_voices(std::size_t polyphony) {
+    arena.reserve(VoicePool::arena_bytes(polyphony) + Pool<Event>::bytes(MAX_PENDING_EVENTS) + BLOCK_SCRATCH_BYTES);
+    voices.allocate(polyphony, arena);
+    events.allocate(arena, MAX_PENDING_EVENTS);
+    pending = nullptr;
+    scratch.allocate(arena, BLOCK_SCRATCH_BYTES);
+    graph.reserve(voices.max_chunks() + 1 + MAX_PATCH_TASKS);
+    scheduler->reserve(graph.capacity());
+}
 
-    outputParameters.device = index;
-    if (outputParameters.device == paNoDevice) {
-        return false;
-    }
+void Synth::set_render_threads(std::size_t threads, bool spin, bool pin) {
+    scheduler.reset();
+    scheduler = std::make_unique<Scheduler>(std::max<std::size_t>(threads, 1) - 1, spin, pin);
+    scheduler->reserve(graph.capacity());
+    voices.set_threads(scheduler->concurrency());
+}
 
-    const PaDeviceInfo* pInfo = Pa_GetDeviceInfo(index);
-    if (pInfo != 0)
-    {
-        printf("Output device name: %s\r", pInfo->name);
+void Synth::set_smoothing(Smoothing mode, float ramp_ms) {
+    gain.configure(mode, ramp_ms);
+    for (int o = 0; o < OSC_COUNT; o++) {
+        osc_gain[o].configure(mode, ramp_ms);
+        sustain[o].configure(mode, ramp_ms);
     }
+}
 
-    outputParameters.channelCount = 2;
-    outputParameters.sampleFormat = paFloat32;
-    outputParameters.suggestedLatency = Pa_GetDeviceInfo(outputParameters.device)->defaultLowOutputLatency;
-    outputParameters.hostApiSpecificStreamInfo = NULL;
-
-    PaError err = Pa_OpenStream(&stream, NULL, &outputParameters, SAMPLE_RATE, 512, 0, &Synth::paCallback, this);
-
-    if (err != paNoError)
-    {
-        return false;
-    }
-
-    err = Pa_SetStreamFinishedCallback(stream, &Synth::paStreamFinished);
-
-    if (err != paNoError)
-    {
-        Pa_CloseStream(stream);
-        stream = 0;
-
+bool Synth::open(AudioBackend* backend_, std::size_t polyphony) {
+    allocate_voices(polyphony);
+    if (backend_ == 0 || !backend_->open(this))
         return false;
-    }
-
+    backend = backend_;
     return true;
 }
 
 bool Synth::close() {
-    if (stream == 0)
+    if (backend == 0)
         return false;
-    PaError err = Pa_CloseStream(stream);
-    stream = 0;
-    return (err == paNoError);
+    bool ok = backend->close();
+    backend = 0;
+    return ok;
 }
 
 bool Synth::start() {
-    if (stream == 0)
+    if (backend == 0)
         return false;
-    PaError err = Pa_StartStream(stream);
-    return (err == paNoError);
+    return backend->start();
 }
 
 bool Synth::stop() {
-    if (stream == 0)
+    if (backend == 0)
         return false;
-    PaError err = Pa_StopStream(stream);
-    return (err == paNoError);
-}
-
-int Synth::paCallbackMethod(const void* inputBuffer, 
-                            void* outputBuffer, 
-                            unsigned long framesPerBuffer, 
-                            const PaStreamCallbackTimeInfo* timeInfo, 
-                            PaStreamCallbackFlags statusFlags) {
-
-    float* out = (float*)outputBuffer;
-    (void)timeInfo;
-    (void)statusFlags;
-    (void)inputBuffer;
-
-    for (std::size_t i = 0; i < framesPerBuffer; i++) {
-        *out++ = amplitude * (
-            oscA.env.get_amp(get_time()) * oscA.interpolate_left() +
-            oscB.env.get_amp(get_time()) * oscB.interpolate_left() +
-            oscC.env.get_amp(get_time()) * oscC.interpolate_left());
-        *out++ = amplitude * (
-            oscA.env.get_amp(get_time()) * oscA.interpolate_right() +
-            oscB.env.get_amp(get_time()) * oscB.interpolate_right() +
-            oscC.env.get_amp(get_time()) * oscC.interpolate_right());
-
-        for (std::size_t j = 0; j < 3; ++j) {
-            oscs[j]->left_phase += oscs[j]->left_phase_inc;
-            if (oscs[j]->left_phase >= TABLE_SIZE) oscs[j]->left_phase -= TABLE_SIZE;
-            oscs[j]->right_phase += oscs[j]->right_phase_inc;
-            if (oscs[j]->right_phase >= TABLE_SIZE) oscs[j]->right_phase -= TABLE_SIZE; 
+    return backend->stop();
+}
+
+bool Synth::send(const Command& cmd) {
+    return commands.push(cmd);
+}
+
+bool Synth::note_on(int note, std::uint64_t at) {
+    Command cmd{ Command::Type::note_on };
+    cmd.note = note;
+    cmd.at = at;
+    return send(cmd);
+}
+
+bool Synth::note_off(int note, std::uint64_t at) {
+    Command cmd{ Command::Type::note_off };
+    cmd.note = note;
+    cmd.at = at;
+    return send(cmd);
+}
+
+MemoryStats Synth::memory() const {
+    MemoryStats stats;
+    stats.arena_bytes = arena.size();
+    stats.voice_slots = voices.slots().capacity();
+    stats.voices_peak = voices.slots().high_water();
+    stats.events = events.capacity();
+    stats.events_peak = events.high_water();
+    stats.scratch_bytes = scratch.size();
+    stats.scratch_peak = scratch.high_water();
+    // a full voice pool is normal, the quietest fading voice gives up its slot
+    stats.misses = events.failures() + scratch.failures();
+    return stats;
+}
+
+bool Synth::set_param(int osc, Param param, float value) {
+    Command cmd{ Command::Type::set_param };
+    cmd.osc = osc;
+    cmd.param = param;
+    cmd.value = value;
+    return send(cmd);
+}
+
+void Synth::publish_table(int osc, std::shared_ptr<const WavetableBank> bank) {
+    if (bank == live_tables[osc])
+        return;
+    published[osc].exchange(bank.get());
+    // a block that started before the exchange may still read the old table, keep it until that block is done
+    if (live_tables[osc])
+        retired_tables.emplace_back(std::move(live_tables[osc]), blocks_done.load());
+    live_tables[osc] = std::move(bank);
+    collect_retired();
+}
+
+bool Synth::publish_patch(const Patch& patch, std::string* error) {
+    TraceZone zone("compile patch");
+    auto compiled = std::make_shared<PatchPlan>();
+    if (!compiled->compile(patch, error))
+        return false;
+    published_plan.exchange(compiled.get());
+    if (live_plan)
+        retired_plans.emplace_back(std::move(live_plan), blocks_done.load());
+    live_plan = std::move(compiled);
+    collect_retired();
+    return true;
+}
+
+void Synth::collect_retired() {
+    const std::uint64_t done = blocks_done.load();
+    std::erase_if(retired_tables, [done](const auto& retired) { return done > retired.second; });
+    const PatchPlan* in_use = plan_in_use.load(std::memory_order_acquire);
+    std::erase_if(retired_plans, [done, in_use](const auto& retired) { return done > retired.second && retired.first.get() != in_use; });
+}
+
+const WavetableBank* Synth::table(int osc) const {
+    return live_tables[osc] ? live_tables[osc].get() : silent_bank();
+}
+
+void Synth::apply(const Command& cmd, std::uint64_t clock) {
+    const int o = (cmd.osc >= 0 && cmd.osc < OSC_COUNT) ? cmd.osc : 0;
+    Oscillator* osc = oscs[o];
+    switch (cmd.type)
+    {
+        case Command::Type::note_on:
+            voices.note_on(cmd.note, clock);
+            break;
+        case Command::Type::note_off:
+            voices.note_off(osc_block.data(), cmd.note, clock);
+            break;
+        case Command::Type::set_param:
+            switch (cmd.param)
+            {
+                case Param::attack:      osc->env.attack_time = cmd.value; break;
+                case Param::decay:       osc->env.decay_time = cmd.value; break;
+                case Param::sustain:     osc->env.sustain_amp = cmd.value; break;
+                case Param::release:     osc->env.release_time = cmd.value; break;
+                case Param::osc_amp:     osc->amp = cmd.value; break;
+            }
+            break;
+    }
+}
+
+// moves queued commands into the time ordered pending list, one that finds no free event is applied now
+void Synth::take_commands() {
+    Command cmd;
+    while (commands.pop(cmd)) {
+        Event* event = events.acquire();
+        if (event == nullptr) {
+            apply(cmd, now());
+            continue;
         }
+        event->cmd = cmd;
+        // behind everything due no later, so commands for the same time keep their order
+        Event** at = &pending;
+        while (*at && (*at)->cmd.at <= cmd.at)
+            at = &(*at)->next;
+        event->next = *at;
+        *at = event;
     }
-    return paContinue;
 }
 
-int Synth::paCallback(const void* inputBuffer, 
-                      void* outputBuffer, 
-                      unsigned long framesPerBuffer, 
-                      const PaStreamCallbackTimeInfo* timeInfo, 
-                      PaStreamCallbackFlags statusFlags, 
-                      void* userData) {
+void Synth::render(float* out, unsigned long frames) {
+    RtScope rt;
+    while (frames > 0) {
+        take_commands();
+        unsigned long block = std::min<unsigned long>(frames, MAX_BLOCK_SIZE);
+        // a block ends where the next timed command is due, so it lands on its sample
+        if (pending && pending->cmd.at > now())
+            block = (unsigned long)std::min<std::uint64_t>(block, pending->cmd.at - now());
+        render_block(out, block);
+        out += 2 * block;
+        frames -= block;
+    }
+}
+
+void Synth::render_block(float* out, unsigned long frames) {
+    TraceZone zone("block");
+    // the counters are opened for this thread by the control thread, after it has registered
+    perf_register_thread();
+    PerfScope perf(PerfStage::other);
+    const std::uint64_t clock = now();
+
+    scratch.reset();
+    for (int o = 0; o < OSC_COUNT; o++) {
+        bus_left[o] = scratch.take<float>(frames);
+        bus_right[o] = scratch.take<float>(frames);
+    }
+    mix_left = scratch.take<float>(frames);
+    mix_right = scratch.take<float>(frames);
+    if (mix_right == nullptr) {
+        // not allocated yet
+        std::fill_n(out, 2 * frames, 0.0f);
+        return;
+    }
+
+    // key offs release from where the sustain glide had got to
+    update_osc_block();
+    {
+        TraceZone events_zone("events");
+        while (pending && pending->cmd.at <= clock) {
+            Event* due = pending;
+            pending = due->next;
+            apply(due->cmd, clock);
+            events.release(due);
+        }
+    }
+    for (int o = 0; o < OSC_COUNT; o++)
+        if (const WavetableBank* bank = published[o].load(std::memory_order_acquire))
+            oscs[o]->bank = bank;
+
+    // targets are read once here, the glides are only written out while they move
+    for (int o = 0; o < OSC_COUNT; o++) {
+        osc_gain[o].set(oscs[o]->amp);
+        sustain[o].set(oscs[o]->env.sustain_amp);
+        float* ramp = sustain[o].settled() ? nullptr : scratch.take<float>(frames);
+        osc_block[o].sustain_ramp = (ramp && sustain[o].ramp(ramp, frames)) ? ramp : nullptr;
+        ramp = osc_gain[o].settled() ? nullptr : scratch.take<float>(frames);
+        osc_gain_ramp[o] = (ramp && osc_gain[o].ramp(ramp, frames)) ? ramp : nullptr;
+    }
+    gain.set(amplitude.load(std::memory_order_relaxed));
+    update_osc_block();
+    // state carries over into the new plan, then the old one may be freed
+    if (PatchPlan* next = published_plan.load(std::memory_order_acquire); next != plan) {
+        if (plan)
+            next->adopt(*plan);
+        plan = next;
+        plan_in_use.store(plan, std::memory_order_release);
+    }
 
-    return ((Synth*)userData)->paCallbackMethod(inputBuffer, 
-                                                outputBuffer,
-                                                framesPerBuffer,
-                                                timeInfo,
-                                                statusFlags);
+    block_clock = clock;
+    const std::size_t chunks = voices.begin_block(osc_block.data(), frames, clock);
+    graph.clear();
+    const int mix = graph.add(mixdown_task, this, frames, "mixdown");
+    const float* bus_l[OSC_COUNT];
+    const float* bus_r[OSC_COUNT];
+    for (int o = 0; o < OSC_COUNT; o++) {
+        bus_l[o] = bus_left[o];
+        bus_r[o] = bus_right[o];
+    }
+    plan->begin(bus_l, bus_r, voices.any_held(), clock, mix_left, mix_right, frames);
+    if (plan->parallel()) {
+        // a node per step, so effect sends and separate parts run side by side
+        int step_node[MAX_PATCH_TASKS];
+        for (std::size_t i = 0; i < plan->size(); i++) {
+            step_node[i] = -1;
+            if (!plan->task(i))
+                continue;
+            const PlanStep& step = plan->step(i);
+            step_node[i] = graph.add(patch_step_task, this, i, NODE_KIND_NAMES[(int)step.kind]);
+            if (step.reads_bus)
+                graph.depend(mix, step_node[i]);
+            for (int a : step.after)
+                if (a >= 0)
+                    graph.depend(step_node[a], step_node[i]);
+        }
+    }
+    else
+        graph.depend(mix, graph.add(patch_task, this, frames, "patch"));
+    patch_nodes.store(graph.size() - 1, std::memory_order_relaxed);
+    for (std::size_t c = 0; c < chunks; c++)
+        graph.depend(graph.add(VoicePool::chunk_task, &voices, c, "voices"), mix);
+    {
+        TraceZone graph_zone("graph");
+        scheduler->run(graph);
+    }
+    graph_nodes.store(graph.size(), std::memory_order_relaxed);
+    active_voices.store(voices.active_voices(), std::memory_order_relaxed);
+
+    TraceZone output_zone("output");
+    PerfScope perf_output(PerfStage::output);
+    if (float* ramp = gain.settled() ? nullptr : scratch.take<float>(frames); ramp && gain.ramp(ramp, frames)) {
+        for (std::size_t i = 0; i < frames; i++) {
+            *out++ = ramp[i] * mix_left[i];
+            *out++ = ramp[i] * mix_right[i];
+        }
+    }
+    else {
+        const float amp = gain.value();
+        for (std::size_t i = 0; i < frames; i++) {
+            *out++ = amp * mix_left[i];
+            *out++ = amp * mix_right[i];
+        }
+    }
+    sample_clock.store(clock + frames, std::memory_order_relaxed);
+    blocks_done.fetch_add(1, std::memory_order_release);
+    perf_count_block();
 }
 
-void Synth::paStreamFinishedMethod() {
-    printf("Stream Completed: %s\n", message);
+void Synth::update_osc_block() {
+    for (int o = 0; o < OSC_COUNT; o++) {
+        osc_block[o].bank = oscs[o]->bank;
+        osc_block[o].env = oscs[o]->env;
+        // a settled glide is at the target, which may have been set before the first block
+        if (!sustain[o].settled())
+            osc_block[o].env.sustain_amp = sustain[o].value();
+    }
 }
 
-void Synth::paStreamFinished(void* userData) {
-    return ((Synth*)userData)->paStreamFinishedMethod();
+void Synth::mixdown_task(void* synth, std::size_t frames, std::size_t) {
+    PerfScope perf(PerfStage::mix);
+    Synth* st = static_cast<Synth*>(synth);
+    float* left[OSC_COUNT];
+    float* right[OSC_COUNT];
+    for (int o = 0; o < OSC_COUNT; o++) {
+        left[o] = st->bus_left[o];
+        right[o] = st->bus_right[o];
+    }
+    st->voices.mixdown(left, right);
+
+    // oscillator levels, a steady unity one is left alone
+    for (int o = 0; o < OSC_COUNT; o++) {
+        if (const float* ramp = st->osc_gain_ramp[o]) {
+            for (std::size_t i = 0; i < frames; i++) {
+                left[o][i] *= ramp[i];
+                right[o][i] *= ramp[i];
+            }
+        }
+        else if (const float g = st->osc_gain[o].value(); g != 1.0f) {
+            for (std::size_t i = 0; i < frames; i++) {
+                left[o][i] *= g;
+                right[o][i] *= g;
+            }
+        }
+    }
 }
 
+// the whole plan in one node, for plans too big for a node per step
+void Synth::patch_task(void* synth, std::size_t, std::size_t) {
+    PerfScope perf(PerfStage::patch);
+    PatchPlan* plan = static_cast<Synth*>(synth)->plan;
+    for (std::size_t i = 0; i < plan->size(); i++)
+        plan->run_step(i);
+}
 
+void Synth::patch_step_task(void* synth, std::size_t step, std::size_t) {
+    PerfScope perf(PerfStage::patch);
+    static_cast<Synth*>(synth)->plan->run_step(step);
+}
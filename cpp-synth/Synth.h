@@ -1,55 +1,126 @@
 #pragma once
+#include <array>
+#include <memory>
 #include <vector>
 #include "wavetable.h"
-#include "portaudio.h"
+#include "Arena.h"
+#include "AudioBackend.h"
+#include "CommandQueue.h"
+#include "Patch.h"
+#include "Smoothed.h"
+#include "Voice.h"
+#include "Scheduler.h"
 
-constexpr auto SAMPLE_RATE = 48000;
+// timed commands that can wait in the audio thread's list at once
+constexpr auto MAX_PENDING_EVENTS = 1024;
+// per block scratch: the oscillator buses, the mix, and a ramp for every smoothed control
+constexpr std::size_t BLOCK_SCRATCH_BYTES = (4 * OSC_COUNT + 3) * arena_round(MAX_BLOCK_SIZE * sizeof(float));
+
+// high-water marks of the audio thread's memory, to size it from
+struct MemoryStats
+{
+    std::size_t arena_bytes   = 0;
+    std::size_t voice_slots   = 0;
+    std::size_t voices_peak   = 0;
+    std::size_t events        = 0;
+    std::size_t events_peak   = 0;
+    std::size_t scratch_bytes = 0;
+    std::size_t scratch_peak  = 0;
+    // events and scratch refused because they ran out
+    std::size_t misses        = 0;
+};
 
 class Synth
 {
 private:
-    PaStream* stream{ 0 };
-    char message[20];
+    AudioBackend* backend{ 0 };
+    SpscQueue<Command, 256> commands;
+    std::atomic<std::uint64_t> blocks_done{ 0 };
+    // tables handed to the audio thread, and GUI side ownership of them until it can no longer be reading them
+    std::array<std::atomic<const WavetableBank*>, OSC_COUNT> published{};
+    std::array<std::shared_ptr<const WavetableBank>, OSC_COUNT> live_tables;
+    std::vector<std::pair<std::shared_ptr<const WavetableBank>, std::uint64_t>> retired_tables;
+    // compiled patches go over the same way; the audio thread reads the plan it replaces once more
+    // when it swaps, so a retired plan is also kept while it is still the one in use
+    std::atomic<PatchPlan*> published_plan{ nullptr };
+    std::atomic<const PatchPlan*> plan_in_use{ nullptr };
+    std::shared_ptr<PatchPlan> live_plan;
+    std::vector<std::pair<std::shared_ptr<PatchPlan>, std::uint64_t>> retired_plans;
+    PatchPlan* plan{ nullptr };
+    // everything the audio thread keeps, carved when the voices are allocated
+    Arena arena;
+    Pool<Event> events;
+    Event* pending{ nullptr };
+    BlockArena scratch;
+    // per block graph: the voice chunks, the mixdown into the oscillator buses, then the patch
+    std::unique_ptr<Scheduler> scheduler;
+    TaskGraph graph;
+    // this block's buffers, taken from scratch
+    float* bus_left[OSC_COUNT]{};
+    float* bus_right[OSC_COUNT]{};
+    float* mix_left{ nullptr };
+    float* mix_right{ nullptr };
+    const float* osc_gain_ramp[OSC_COUNT]{};
+    std::uint64_t block_clock{ 0 };
+    // gliding copies of amplitude, the oscillator amps and sustain levels, stepped once per block
+    Smoothed gain;
+    std::array<Smoothed, OSC_COUNT> osc_gain;
+    std::array<Smoothed, OSC_COUNT> sustain;
+    // the oscillators as the voices see them this block
+    std::array<OscBlock, OSC_COUNT> osc_block;
 public:
     Oscillator oscA;
     Oscillator oscB;
     Oscillator oscC;
-    std::vector<Oscillator*> oscs { &oscA, &oscB, &oscC };
+    std::array<Oscillator*, OSC_COUNT> oscs { &oscA, &oscB, &oscC };
+    VoicePool voices;
     std::atomic<float> amplitude{ 0.1f };
+    std::atomic<std::uint64_t> sample_clock{ 0 };
+    std::atomic<std::size_t> active_voices{ 0 };
 
 public:
     Synth();
-    bool open(PaDeviceIndex index);
+    // reserves the arena and carves the voices, events and block scratch from it; open() does this,
+    // nothing renders before it
+    void allocate_voices(std::size_t polyphony);
+    MemoryStats memory() const;
+    // voices rendered on this many threads including the audio thread, set before start()
+    void set_render_threads(std::size_t threads, bool spin = false, bool pin = false);
+    std::size_t render_threads() const { return scheduler->concurrency(); }
+    // how level changes glide, set before start()
+    void set_smoothing(Smoothing mode, float ramp_ms);
+    // timing of the last block's graph: node 0 is the mixdown, the next patch_nodes are the patch, one
+    // per step or the whole plan in one, and the rest are voice chunks
+    std::atomic<std::size_t> graph_nodes{ 0 };
+    std::atomic<std::size_t> patch_nodes{ 0 };
+    const TaskNode& graph_node(std::size_t i) const { return graph.node(i); }
+    bool open(AudioBackend* backend, std::size_t polyphony = DEFAULT_POLYPHONY);
     bool close();
     bool start();
     bool stop();
+    std::uint64_t now() const { return sample_clock.load(std::memory_order_relaxed); }
+    // control from one other thread, queued and applied by the audio thread at the next block
+    bool send(const Command& cmd);
+    // at is a sample clock time to play it at, 0 for the next block
+    bool note_on(int note, std::uint64_t at = 0);
+    bool note_off(int note, std::uint64_t at = 0);
+    bool set_param(int osc, Param param, float value);
+    // table snapshots and patches, GUI thread only
+    void publish_table(int osc, std::shared_ptr<const WavetableBank> bank);
+    // compiles the patch here and swaps it in at the next block, false with the reason in error if it does not compile
+    bool publish_patch(const Patch& patch, std::string* error = nullptr);
+    // frees the tables and plans the audio thread has moved past
+    void collect_retired();
+    const WavetableBank* table(int osc) const;
+    const PatchPlan& patch_plan() const { return *live_plan; }
+    // renders interleaved stereo frames, any frame count, independent of the audio device
+    void render(float* out, unsigned long frames);
 private:
-    int paCallbackMethod(const void*, 
-                         void*, 
-                         unsigned long, 
-                         const PaStreamCallbackTimeInfo*, 
-                         PaStreamCallbackFlags);
-    static int paCallback(const void* inputBuffer, 
-                          void* outputBuffer, 
-                          unsigned long framesPerBuffer, 
-                          const PaStreamCallbackTimeInfo* timeInfo, 
-                          PaStreamCallbackFlags statusFlags, 
-                          void* userData);
-    void paStreamFinishedMethod();
-    static void paStreamFinished(void* userData);
-};
-
-class ScopedPaHandler {
-public:
-    ScopedPaHandler() : _result(Pa_Initialize()) {}
-    ~ScopedPaHandler()
-    {
-        if (_result == paNoError)
-        {
-            Pa_Terminate();
-        }
-    }
-    PaError result() const { return _result; }
-private:
-    PaError _result;
+    void apply(const Command& cmd, std::uint64_t clock);
+    void take_commands();
+    void update_osc_block();
+    void render_block(float* out, unsigned long frames);
+    static void mixdown_task(void* synth, std::size_t arg, std::size_t thread);
+    static void patch_task(void* synth, std::size_t arg, std::size_t thread);
+    static void patch_step_task(void* synth, std::size_t step, std::size_t thread);
 };
@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include "CallbackTiming.h"
+#include "Trace.h"
+
+namespace {
+
+// a TraceEvent the dump can read while the owner thread overwrites it
+struct TraceSlot
+{
+    std::atomic<const char*>   name{ "" };
+    std::atomic<std::uint64_t> start{ 0 };
+    std::atomic<std::uint64_t> ticks{ 0 };
+};
+
+struct TraceRing
+{
+    // zones written so far, the last TRACE_RING_EVENTS of them are still in events
+    std::atomic<std::uint64_t> head{ 0 };
+    // zones begun, one ahead of head while a slot is being overwritten
+    std::atomic<std::uint64_t> begun{ 0 };
+    std::atomic<const char*>   name{ "thread" };
+    std::atomic<int>           index{ -1 };
+    TraceSlot                  events[TRACE_RING_EVENTS];
+};
+
+std::atomic<bool>         enabled{ false };
+std::atomic<TraceRing*>   rings{ nullptr };
+std::atomic<int>          rings_claimed{ 0 };
+
+thread_local TraceRing*   ring = nullptr;
+thread_local const char*  thread_name = nullptr;
+thread_local int          thread_index = -1;
+
+// the calling thread's ring, claimed on first use, nullptr once every ring is taken
+TraceRing* thread_ring() {
+    if (ring)
+        return ring;
+    TraceRing* all = rings.load(std::memory_order_acquire);
+    if (all == nullptr)
+        return nullptr;
+    const int slot = rings_claimed.fetch_add(1, std::memory_order_relaxed);
+    if (slot >= TRACE_THREADS)
+        return nullptr;
+    ring = &all[slot];
+    if (thread_name) {
+        ring->name.store(thread_name, std::memory_order_relaxed);
+        ring->index.store(thread_index, std::memory_order_relaxed);
+    }
+    return ring;
+}
+
+} // namespace
+
+void trace_thread(const char* name, int index) {
+    if (thread_name == name && thread_index == index)
+        return;
+    thread_name = name;
+    thread_index = index;
+    if (ring) {
+        ring->name.store(name, std::memory_order_relaxed);
+        ring->index.store(index, std::memory_order_relaxed);
+    }
+}
+
+void trace_enable(bool on) {
+    if (on && rings.load(std::memory_order_acquire) == nullptr) {
+        // never freed, threads keep pointers into it
+        rings.store(new TraceRing[TRACE_THREADS], std::memory_order_release);
+        // calibrate now rather than in the first dump
+        ns_per_tick();
+    }
+    enabled.store(on, std::memory_order_relaxed);
+}
+
+bool trace_enabled() {
+    return enabled.load(std::memory_order_relaxed);
+}
+
+TraceZone::TraceZone(const char* name) : name(name), start(0) {
+    if (enabled.load(std::memory_order_relaxed))
+        start = timing_ticks();
+}
+
+TraceZone::~TraceZone() {
+    if (start == 0)
+        return;
+    const std::uint64_t end = timing_ticks();
+    TraceRing* r = thread_ring();
+    if (r == nullptr)
+        return;
+    const std::uint64_t h = r->head.load(std::memory_order_relaxed);
+    // a dump that reads any of the new fields also sees begun move past h, and drops the slot
+    r->begun.store(h + 1, std::memory_order_relaxed);
+    TraceSlot& slot = r->events[h % TRACE_RING_EVENTS];
+    slot.name.store(name, std::memory_order_release);
+    slot.start.store(start, std::memory_order_release);
+    slot.ticks.store(end - start, std::memory_order_release);
+    r->head.store(h + 1, std::memory_order_release);
+}
+
+bool trace_dump(const char* path) {
+    TraceRing* all = rings.load(std::memory_order_acquire);
+    FILE* f = fopen(path, "w");
+    if (f == nullptr)
+        return false;
+    // copied out first so the file is written without racing the writers
+    struct Copy
+    {
+        int                     tid;
+        const char*             name;
+        int                     index;
+        std::vector<TraceEvent> events;
+    };
+    std::vector<Copy> copies;
+    std::uint64_t origin = UINT64_MAX;
+    const int claimed = all ? std::min(rings_claimed.load(std::memory_order_relaxed), TRACE_THREADS) : 0;
+    for (int t = 0; t < claimed; t++) {
+        TraceRing& r = all[t];
+        const std::uint64_t head = r.head.load(std::memory_order_acquire);
+        const std::uint64_t first = head > TRACE_RING_EVENTS ? head - TRACE_RING_EVENTS : 0;
+        Copy c{ t + 1, r.name.load(std::memory_order_relaxed), r.index.load(std::memory_order_relaxed), {} };
+        c.events.reserve((std::size_t)(head - first));
+        for (std::uint64_t i = first; i < head; i++) {
+            const TraceSlot& slot = r.events[i % TRACE_RING_EVENTS];
+            c.events.push_back({ slot.name.load(std::memory_order_acquire), slot.start.load(std::memory_order_acquire),
+                slot.ticks.load(std::memory_order_acquire) });
+        }
+        // whatever the writer began to overwrite while this was copying may be torn
+        const std::uint64_t after = r.begun.load(std::memory_order_relaxed);
+        const std::uint64_t stale = after > TRACE_RING_EVENTS ? after - TRACE_RING_EVENTS : 0;
+        if (stale > first)
+            c.events.erase(c.events.begin(), c.events.begin() + (std::ptrdiff_t)std::min(stale - first, head - first));
+        for (const TraceEvent& e : c.events)
+            origin = std::min(origin, e.start);
+        copies.push_back(std::move(c));
+    }
+
+    // microseconds from the earliest zone
+    const double us = ns_per_tick() / 1000.0;
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"cpp-synth\"}}");
+    for (const Copy& c : copies) {
+        if (c.index >= 0)
+            fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s %d\"}}", c.tid, c.name, c.index);
+        else
+            fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}", c.tid, c.name);
+        for (const TraceEvent& e : c.events)
+            fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                e.name, c.tid, (double)(e.start - origin) * us, (double)e.ticks * us);
+    }
+    fprintf(f, "\n]}\n");
+    return fclose(f) == 0;
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Scoped trace zones for a Chrome trace / Perfetto timeline of the audio, worker and GUI threads.
+// Each thread writes finished zones into its own ring, claimed the first time it records, and
+// trace_dump() writes whatever the rings hold as Chrome trace JSON. Recording is off until
+// trace_enable(), and a zone then costs two timestamps and a store into the ring.
+
+// zones kept per thread, older ones are overwritten
+constexpr auto TRACE_RING_EVENTS = 1 << 14;
+// threads that can record, later ones are not traced
+constexpr auto TRACE_THREADS     = 32;
+
+// names the calling thread in the dump, index is appended when not negative; name must outlive the dump
+void        trace_thread(const char* name, int index = -1);
+// the rings are allocated on first enable and kept, so enable on a thread that may allocate
+void        trace_enable(bool on);
+bool        trace_enabled();
+// false when the file cannot be written; rings keep recording while they are read, zones
+// overwritten during the dump are left out
+bool        trace_dump(const char* path);
+
+struct TraceEvent
+{
+    const char*   name  = "";
+    std::uint64_t start = 0;
+    std::uint64_t ticks = 0;
+};
+
+// One zone from construction to destruction. name must be a string that outlives the dump, a literal
+// or a TaskNode name.
+class TraceZone
+{
+private:
+    const char*   name;
+    std::uint64_t start;
+public:
+    explicit TraceZone(const char* name);
+    ~TraceZone();
+    TraceZone(const TraceZone&) = delete;
+    TraceZone& operator=(const TraceZone&) = delete;
+};
@@ -0,0 +1,354 @@
+#include <algorithm>
+#include "PerfCounters.h"
+#include "Voice.h"
+
+bool Voice::held() const {
+    for (const auto& layer : layers)
+        if (layer.env.note_on())
+            return true;
+    return false;
+}
+
+float Voice::loudness() const {
+    float level = 0.0f;
+    for (const auto& layer : layers)
+        level = std::max(level, layer.env.level);
+    return level * gain;
+}
+
+void Voice::start(int note_, std::uint64_t sample) {
+    note = note_;
+    started = sample;
+    phase_inc = note_phase_inc(note_);
+    phase_inc_fx = fixed_phase_inc(phase_inc);
+    gain = 1.0f;
+    gain_step = 0.0f;
+    for (auto& layer : layers) {
+        layer.env = Envelope{};
+        layer.env.key_on(sample);
+        layer.left_phase = 0;
+        layer.right_phase = 0;
+        layer.left_phase_fx = 0;
+        layer.right_phase_fx = 0;
+    }
+}
+
+void Voice::release(const OscBlock* oscs, std::uint64_t sample) {
+    for (int o = 0; o < OSC_COUNT; o++)
+        layers[o].env.key_off(oscs[o].env, sample);
+}
+
+void Voice::steal() {
+    gain_step = -gain / STEAL_FADE_SAMPLES;
+}
+
+void Voice::envelope(int o, const OscBlock& osc, float* out, std::size_t stride, unsigned long frames, std::uint64_t clock) {
+    Envelope& env = layers[o].env;
+    const ADSR& adsr = osc.env;
+    float g = gain;
+    // sustain only ends on a key off, which lands between blocks
+    if (env.stage == Envelope::Stage::sustain && gain_step == 0.0f) {
+        const float amp = g * env.get_amp(adsr, clock);
+        if (osc.sustain_ramp)
+            for (unsigned long i = 0; i < frames; i++)
+                out[i * stride] = g * osc.sustain_ramp[i];
+        else
+            for (unsigned long i = 0; i < frames; i++)
+                out[i * stride] = amp;
+        return;
+    }
+    for (unsigned long i = 0; i < frames; i++) {
+        out[i * stride] = g * env.get_amp(adsr, clock + i);
+        g = std::max(g + gain_step, 0.0f);
+    }
+}
+
+bool Voice::finish(unsigned long frames) {
+    bool sounding = false;
+    for (const auto& layer : layers)
+        sounding = sounding || layer.env.active();
+    gain = std::max(gain + gain_step * frames, 0.0f);
+    return sounding && gain > 0.0f;
+}
+
+void Voice::render(int o, const OscBlock& osc, Kernel kernel, Interpolation interpolation, const float* amp,
+                   float* left, float* right, unsigned long frames) {
+    OscState& layer = layers[o];
+    // band-limited level for this pitch, picked once per block
+    const Wavetable& table = osc.bank->level(mip_level_for(phase_inc));
+    if (kernel == Kernel::reference) {
+        for (unsigned long i = 0; i < frames; i++) {
+            left[i] += amp[i] * table.interpolate_at(layer.left_phase);
+            right[i] += amp[i] * table.interpolate_at(layer.right_phase);
+
+            layer.left_phase += phase_inc;
+            if (layer.left_phase >= TABLE_SIZE) layer.left_phase -= TABLE_SIZE;
+            layer.right_phase += phase_inc;
+            if (layer.right_phase >= TABLE_SIZE) layer.right_phase -= TABLE_SIZE;
+        }
+    }
+    else {
+        const PhaseMode mode = (layer.left_phase_fx == layer.right_phase_fx) ? PhaseMode::linked : PhaseMode::independent;
+        layer_kernel(interpolation, mode)(table.fixed, layer.left_phase_fx, layer.right_phase_fx, phase_inc_fx, amp, left, right, frames);
+    }
+}
+
+namespace {
+    std::size_t slot_count(std::size_t polyphony) { return std::max<std::size_t>(polyphony, 1) + FADE_SLOTS; }
+    // every chunk but the last of each oscillator is full
+    std::size_t chunk_slots(std::size_t polyphony) { return OSC_COUNT * (slot_count(polyphony) / CHUNK_LAYERS + 1); }
+}
+
+std::size_t VoicePool::arena_bytes(std::size_t polyphony) {
+    return Pool<Voice>::bytes(slot_count(polyphony)) + arena_round(slot_count(polyphony) * sizeof(int))
+         + arena_round(chunk_slots(polyphony) * sizeof(VoiceChunk));
+}
+
+bool VoicePool::allocate(std::size_t polyphony_, Arena& arena) {
+    polyphony = std::max<std::size_t>(polyphony_, 1);
+    const bool carved = voices.allocate(arena, slot_count(polyphony));
+    active = arena.carve_array<int>(slot_count(polyphony));
+    active_count = 0;
+    chunks = arena.carve_array<VoiceChunk>(chunk_slots(polyphony));
+    chunk_capacity = chunks ? chunk_slots(polyphony) : 0;
+    chunk_count = 0;
+    set_threads(std::max<std::size_t>(scratch.size(), 1));
+    return carved && active && chunks;
+}
+
+void VoicePool::set_threads(std::size_t threads) {
+    scratch.resize(std::max<std::size_t>(threads, 1));
+    for (auto& s : scratch)
+        if (!s)
+            s = std::make_unique<LaneScratch>();
+}
+
+Voice* VoicePool::free_voice() {
+    if (Voice* voice = voices.acquire())
+        return voice;
+
+    // every slot is busy, cut the quietest of the voices already fading out and take its slot
+    Voice* cut = nullptr;
+    for (int idx : active_list()) {
+        Voice& voice = voices[idx];
+        if (voice.fading() && (cut == nullptr || voice.gain < cut->gain))
+            cut = &voice;
+    }
+    if (cut != nullptr) {
+        active_count = std::remove(active, active + active_count, (int)voices.index_of(cut)) - active;
+        *cut = Voice{};
+    }
+    return cut;
+}
+
+Voice* VoicePool::victim() {
+    Voice* pick = nullptr;
+    for (int idx : active_list()) {
+        Voice& voice = voices[idx];
+        if (voice.fading())
+            continue;
+        if (pick == nullptr
+            || (steal_policy == StealPolicy::oldest && voice.started < pick->started)
+            || (steal_policy == StealPolicy::quietest && voice.loudness() < pick->loudness()))
+            pick = &voice;
+    }
+    return pick;
+}
+
+void VoicePool::note_on(int note, std::uint64_t sample) {
+    if (voices.capacity() == 0)
+        return;
+    std::size_t playing = 0;
+    for (int idx : active_list())
+        if (!voices[idx].fading())
+            ++playing;
+    if (playing >= polyphony)
+        if (Voice* old = victim())
+            old->steal();
+
+    Voice* voice = free_voice();
+    if (voice == nullptr)
+        return;
+    voice->start(note, sample);
+    voice->playing = true;
+    active[active_count++] = (int)voices.index_of(voice);
+}
+
+void VoicePool::note_off(const OscBlock* oscs, int note, std::uint64_t sample) {
+    for (int idx : active_list()) {
+        Voice& voice = voices[idx];
+        if (voice.note == note && voice.held())
+            voice.release(oscs, sample);
+    }
+}
+
+bool VoicePool::any_held() const {
+    for (int idx : active_list())
+        if (voices[idx].held())
+            return true;
+    return false;
+}
+
+std::size_t VoicePool::begin_block(const OscBlock* oscs, unsigned long frames, std::uint64_t clock) {
+    block_oscs = oscs;
+    block_frames = frames;
+    block_clock = clock;
+    plan_chunks();
+    return chunk_count;
+}
+
+void VoicePool::mixdown(float* const* left, float* const* right) {
+    for (int o = 0; o < OSC_COUNT; o++) {
+        std::fill_n(left[o], block_frames, 0.0f);
+        std::fill_n(right[o], block_frames, 0.0f);
+    }
+    // fixed summing order, whichever thread rendered each chunk
+    for (std::size_t c = 0; c < chunk_count; c++) {
+        const VoiceChunk& chunk = chunks[c];
+        float* bus_left = left[chunk.osc];
+        float* bus_right = right[chunk.osc];
+        for (unsigned long i = 0; i < block_frames; i++) {
+            bus_left[i] += chunk.left[i];
+            bus_right[i] += chunk.right[i];
+        }
+    }
+
+    // compact the finished voices out, keeping activation order, and give their slots back
+    std::size_t kept = 0;
+    for (std::size_t k = 0; k < active_count; k++) {
+        Voice& voice = voices[active[k]];
+        if (voice.finish(block_frames))
+            active[kept++] = active[k];
+        else {
+            voice.playing = false;
+            voices.release(&voice);
+        }
+    }
+    active_count = kept;
+}
+
+// cuts the sounding layers of each oscillator into runs of CHUNK_LAYERS, in active list order
+void VoicePool::plan_chunks() {
+    chunk_count = 0;
+    auto close = [this](int o, std::size_t first, std::size_t last) {
+        VoiceChunk& chunk = chunks[chunk_count++];
+        chunk.osc = o;
+        chunk.first = first;
+        chunk.last = last;
+    };
+    for (int o = 0; o < OSC_COUNT; o++) {
+        std::size_t first = 0;
+        int layers = 0;
+        for (std::size_t k = 0; k < active_count; k++) {
+            if (!voices[active[k]].layers[o].env.active())
+                continue;
+            if (layers == CHUNK_LAYERS) {
+                close(o, first, k);
+                layers = 0;
+            }
+            if (layers == 0)
+                first = k;
+            ++layers;
+        }
+        if (layers > 0)
+            close(o, first, active_count);
+    }
+}
+
+void VoicePool::chunk_task(void* pool, std::size_t chunk, std::size_t thread) {
+    static_cast<VoicePool*>(pool)->render_chunk(chunk, thread);
+}
+
+void VoicePool::render_chunk(std::size_t c, std::size_t thread) {
+    VoiceChunk& chunk = chunks[c];
+    const unsigned long frames = block_frames;
+    const int o = chunk.osc;
+    const OscBlock& osc = block_oscs[o];
+    LaneScratch& s = *scratch[thread];
+    const bool lanes = kernel == Kernel::simd && interpolation == Interpolation::linear;
+
+    // the envelopes of the sounding layers first, so the stage is charged once per chunk
+    Voice* sounding[CHUNK_LAYERS];
+    int count = 0;
+    {
+        PerfScope perf(PerfStage::envelopes);
+        for (std::size_t k = chunk.first; k < chunk.last; k++) {
+            Voice& voice = voices[active[k]];
+            if (!voice.layers[o].env.active())
+                continue;
+            if (lanes)
+                voice.envelope(o, osc, &s.env[(count / LANE_GROUP) * LANE_GROUP * MAX_BLOCK_SIZE + count % LANE_GROUP],
+                               LANE_GROUP, frames, block_clock);
+            else
+                voice.envelope(o, osc, &s.env[count * MAX_BLOCK_SIZE], 1, frames, block_clock);
+            sounding[count++] = &voice;
+        }
+    }
+
+    PerfScope perf(PerfStage::oscillators);
+    std::fill_n(chunk.left, frames, 0.0f);
+    std::fill_n(chunk.right, frames, 0.0f);
+    if (!lanes) {
+        for (int v = 0; v < count; v++)
+            sounding[v]->render(o, osc, kernel, interpolation, &s.env[v * MAX_BLOCK_SIZE], chunk.left, chunk.right, frames);
+        return;
+    }
+
+    s.mix.clear(frames);
+    s.groups = 0;
+    for (int first = 0; first < count; first += LANE_GROUP) {
+        s.group.env = &s.env[first * MAX_BLOCK_SIZE];
+        s.lanes = std::min(count - first, LANE_GROUP);
+        for (int lane = 0; lane < s.lanes; lane++) {
+            Voice& voice = *sounding[first + lane];
+            OscState& layer = voice.layers[o];
+            s.group.tables[lane] = osc.bank->level(mip_level_for(voice.phase_inc)).fixed;
+            s.group.left_phase[lane] = layer.left_phase_fx;
+            s.group.right_phase[lane] = layer.right_phase_fx;
+            s.group.phase_inc[lane] = voice.phase_inc_fx;
+            s.owner[lane] = &layer;
+        }
+        // a few lanes left over are cheaper one layer at a time than padded out to a whole group
+        if (s.lanes <= LANE_GROUP / 4)
+            render_tail(s, chunk, frames);
+        else
+            flush_lanes(s, frames);
+    }
+    if (s.groups > 0)
+        dsp.reduce(s.mix, chunk.left, chunk.right, frames);
+}
+
+// renders the gathered lanes, padding the rest with silent copies of the first, and hands the phases back
+void VoicePool::flush_lanes(LaneScratch& s, unsigned long frames) {
+    if (s.lanes == 0)
+        return;
+    for (int lane = s.lanes; lane < LANE_GROUP; lane++) {
+        s.group.tables[lane] = s.group.tables[0];
+        s.group.left_phase[lane] = 0;
+        s.group.right_phase[lane] = 0;
+        s.group.phase_inc[lane] = 0;
+        for (unsigned long i = 0; i < frames; i++)
+            s.group.env[i * LANE_GROUP + lane] = 0.0f;
+    }
+    dsp.render_group(s.group, frames, s.mix);
+    ++s.groups;
+    for (int lane = 0; lane < s.lanes; lane++) {
+        s.owner[lane]->left_phase_fx = s.group.left_phase[lane];
+        s.owner[lane]->right_phase_fx = s.group.right_phase[lane];
+    }
+    s.lanes = 0;
+}
+
+// the gathered lanes through the per-voice linear kernel, straight into the chunk
+void VoicePool::render_tail(LaneScratch& s, VoiceChunk& chunk, unsigned long frames) {
+    float amp[MAX_BLOCK_SIZE];
+    for (int lane = 0; lane < s.lanes; lane++) {
+        for (unsigned long i = 0; i < frames; i++)
+            amp[i] = s.group.env[i * LANE_GROUP + lane];
+        OscState& layer = *s.owner[lane];
+        const PhaseMode mode = (layer.left_phase_fx == layer.right_phase_fx) ? PhaseMode::linked : PhaseMode::independent;
+        layer_kernel(Interpolation::linear, mode)(s.group.tables[lane], layer.left_phase_fx, layer.right_phase_fx,
+                                                  s.group.phase_inc[lane], amp, chunk.left, chunk.right, frames);
+    }
+    s.lanes = 0;
+}
@@ -0,0 +1,149 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <vector>
+#include "Arena.h"
+#include "dsp_kernels.h"
+#include "wavetable.h"
+
+constexpr auto OSC_COUNT = 3;
+constexpr auto DEFAULT_POLYPHONY = 128;
+// samples a stolen voice takes to fade out, ~2ms
+constexpr auto STEAL_FADE_SAMPLES = SAMPLE_RATE / 500;
+// voices that can be fading out at once on top of the playable ones
+constexpr auto FADE_SLOTS = 16;
+// layers of one oscillator per render chunk, the unit of work handed to a thread
+constexpr auto CHUNK_LAYERS = 2 * LANE_GROUP;
+
+enum class StealPolicy { oldest, quietest };
+
+// reference: float phase over the TABLE_SIZE tables, fixed_point: 32-bit phase over the power of two tables,
+// simd: the linear fixed_point kernel run across LANE_GROUP voice layers at once
+enum class Kernel { reference, fixed_point, simd };
+
+// what the voices read of one oscillator for a block
+struct OscBlock
+{
+    const WavetableBank* bank         = silent_bank();
+    ADSR                 env;
+    // the sustain level per frame while it glides, null when it holds at env.sustain_amp
+    const float*         sustain_ramp = nullptr;
+};
+
+// one oscillator layer of a voice, the oscillator itself holds the shared table and settings
+struct OscState
+{
+    Envelope      env;
+    float         left_phase     = 0;
+    float         right_phase    = 0;
+    std::uint32_t left_phase_fx  = 0;
+    std::uint32_t right_phase_fx = 0;
+};
+
+struct Voice
+{
+    int           note         = -1;
+    std::uint64_t started      = 0;
+    float         phase_inc    = 1;
+    std::uint32_t phase_inc_fx = 0;
+    float         gain         = 1.0f;
+    float         gain_step    = 0.0f;
+    bool          playing      = false;
+    OscState      layers[OSC_COUNT];
+    bool          fading() const { return gain_step != 0.0f; }
+    bool          held() const;
+    float         loudness() const;
+    void          start(int note, std::uint64_t sample);
+    void          release(const OscBlock* oscs, std::uint64_t sample);
+    void          steal();
+    // gain times the envelope of layer o for each frame, written every stride floats
+    void          envelope(int o, const OscBlock& osc, float* out, std::size_t stride, unsigned long frames, std::uint64_t clock);
+    // moves the steal fade past the block, false once the voice has gone silent
+    bool          finish(unsigned long frames);
+    // adds layer o into the planar mix at the gains in amp, from envelope()
+    void          render(int o, const OscBlock& osc, Kernel kernel, Interpolation interpolation, const float* amp,
+                         float* left, float* right, unsigned long frames);
+};
+
+// simd kernel state of one rendering thread
+struct LaneScratch
+{
+    // a chunk's envelopes, worked out before its oscillators: LANE_GROUP interleaved lanes per group
+    // for the simd kernel, one layer after another for the others
+    alignas(64) float env[CHUNK_LAYERS * MAX_BLOCK_SIZE];
+    OscGroup  group;
+    LaneMix   mix;
+    OscState* owner[LANE_GROUP]{};
+    int       lanes  = 0;
+    // groups rendered into mix since it was cleared
+    int       groups = 0;
+};
+
+// a run of the active list whose layers of one oscillator are rendered together into their own partial mix
+struct VoiceChunk
+{
+    int         osc   = 0;
+    std::size_t first = 0;
+    std::size_t last  = 0;
+    float       left[MAX_BLOCK_SIZE];
+    float       right[MAX_BLOCK_SIZE];
+};
+
+// Fixed pool of voices carved from the synth's arena, only the active ones are rendered. The layers of each
+// oscillator are cut into chunks of up to CHUNK_LAYERS, which can render on separate threads into
+// separate partial mixes. Those are summed in chunk order into one bus per oscillator, so the output
+// does not depend on the thread count.
+class VoicePool
+{
+private:
+    Pool<Voice>        voices;
+    // slots of the sounding voices in the order they started
+    int*               active{ nullptr };
+    std::size_t        active_count{ 0 };
+    std::size_t        polyphony{ 0 };
+    VoiceChunk*        chunks{ nullptr };
+    std::size_t        chunk_capacity{ 0 };
+    std::size_t        chunk_count{ 0 };
+    // one per thread that can render, allocated with the voices
+    std::vector<std::unique_ptr<LaneScratch>> scratch;
+    // the block being rendered, for the chunk tasks
+    const OscBlock*    block_oscs{ nullptr };
+    unsigned long      block_frames{ 0 };
+    std::uint64_t      block_clock{ 0 };
+    Voice*             free_voice();
+    Voice*             victim();
+    std::span<int>     active_list() const { return { active, active_count }; }
+    void               plan_chunks();
+    void               flush_lanes(LaneScratch& s, unsigned long frames);
+    void               render_tail(LaneScratch& s, VoiceChunk& chunk, unsigned long frames);
+public:
+    StealPolicy steal_policy = StealPolicy::oldest;
+    Kernel      kernel       = Kernel::simd;
+    // per-voice fixed-point kernels only, the simd kernels are linear
+    Interpolation interpolation = Interpolation::linear;
+    // simd kernels bound for this CPU when the pool is built
+    DspKernels  dsp          = kernels_for(runtime_simd_tier());
+    // what allocate() carves for this polyphony
+    static std::size_t arena_bytes(std::size_t polyphony);
+    // carves the voices and chunks from arena, not while rendering
+    bool        allocate(std::size_t polyphony, Arena& arena);
+    // scratch for this many rendering threads, not while rendering
+    void        set_threads(std::size_t threads);
+    void        note_on(int note, std::uint64_t sample);
+    void        note_off(const OscBlock* oscs, int note, std::uint64_t sample);
+    // a block in three steps: cut the chunks and return how many, render each chunk on any
+    // thread, then sum them into the OSC_COUNT planar buses and drop the voices that finished
+    std::size_t begin_block(const OscBlock* oscs, unsigned long frames, std::uint64_t clock);
+    void        render_chunk(std::size_t chunk, std::size_t thread);
+    void        mixdown(float* const* left, float* const* right);
+    static void chunk_task(void* pool, std::size_t chunk, std::size_t thread);
+    // whether any voice is still held down, the gate of the patch envelopes
+    bool        any_held() const;
+    std::size_t max_chunks() const { return chunk_capacity; }
+    std::size_t active_voices() const { return active_count; }
+    std::size_t capacity() const { return polyphony; }
+    // voice slots ever in use at once, playing and fading, out of polyphony + FADE_SLOTS
+    const Pool<Voice>& slots() const { return voices; }
+};
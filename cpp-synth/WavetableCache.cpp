@@ -0,0 +1,84 @@
+#include <algorithm>
+#include <cmath>
+#include "builtin_tables.h"
+#include "Trace.h"
+#include "WavetableCache.h"
+
+WavetableCache::WavetableCache(std::size_t capacity)
+    : capacity(std::max<std::size_t>(capacity, 1))
+{
+}
+
+WavetableKey WavetableCache::key(int waveform, float pw, int mip_level) {
+    WavetableKey k;
+    k.waveform = waveform;
+    // only square and triangle depend on the pulse width
+    if (waveform == 2 || waveform == 3)
+        k.pulse_width = (int)std::lround(std::clamp(pw, 0.0f, 1.0f) * PULSE_WIDTH_STEPS);
+    k.mip_level = mip_level;
+    return k;
+}
+
+std::shared_ptr<const Wavetable> WavetableCache::find(const WavetableKey& k) {
+    ++tick;
+    auto it = entries.find(k);
+    if (it == entries.end()) {
+        ++miss_count;
+        return nullptr;
+    }
+    ++hit_count;
+    it->second.last_used = tick;
+    return it->second.table;
+}
+
+void WavetableCache::insert(const WavetableKey& k, std::shared_ptr<const Wavetable> table) {
+    if (entries.size() >= capacity) {
+        auto oldest = std::min_element(entries.begin(), entries.end(),
+            [](const auto& a, const auto& b) { return a.second.last_used < b.second.last_used; });
+        entries.erase(oldest);
+        ++eviction_count;
+    }
+    entries[k] = { std::move(table), tick };
+}
+
+std::shared_ptr<const Wavetable> WavetableCache::get(int waveform, float pw, int mip_level) {
+    return get_bank(waveform, pw)->levels[mip_level];
+}
+
+std::shared_ptr<const WavetableBank> WavetableCache::get_bank(int waveform, float pw) {
+    TraceZone zone("table bank");
+    // canonical shapes are compiled in and never take a cache entry
+    const bool pulse = (waveform == 2 || waveform == 3);
+    if (key(waveform, pw).pulse_width == (pulse ? PULSE_WIDTH_STEPS / 2 : 0))
+        if (auto bank = builtin_bank(waveform))
+            return bank;
+    const WavetableKey bank_key = key(waveform, pw);
+    if (auto it = banks.find(bank_key); it != banks.end())
+        if (auto held = it->second.lock())
+            return held;
+    auto bank = std::make_shared<WavetableBank>();
+    std::unique_ptr<Spectrum> spectrum;
+    for (int level = 0; level < MIP_LEVELS; level++) {
+        const WavetableKey k = key(waveform, pw, level);
+        bank->levels[level] = find(k);
+        if (bank->levels[level])
+            continue;
+        if (!spectrum) {
+            spectrum = std::make_unique<Spectrum>();
+            analyse(*make_wavetable(waveform, (float)k.pulse_width / PULSE_WIDTH_STEPS), spectrum.get());
+        }
+        TraceZone level_zone("table synthesis");
+        auto table = std::make_shared<Wavetable>();
+        synthesise(*spectrum, mip_harmonics(level), table.get());
+        insert(k, table);
+        bank->levels[level] = std::move(table);
+    }
+    std::erase_if(banks, [](const auto& b) { return b.second.expired(); });
+    banks[bank_key] = bank;
+    return bank;
+}
+
+void WavetableCache::clear() {
+    entries.clear();
+    banks.clear();
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <compare>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include "wavetable.h"
+
+// pulse width steps kept apart by the cache
+constexpr auto PULSE_WIDTH_STEPS = 1024;
+
+struct WavetableKey
+{
+    int waveform    = 0;
+    int pulse_width = 0;
+    int table_size  = TABLE_SIZE;
+    int mip_level   = 0;
+    auto operator<=>(const WavetableKey&) const = default;
+};
+
+// Shared read-only tables, generated once per distinct setting and evicted least recently used first.
+// GUI thread only, tables already handed out stay alive through their shared_ptr after eviction.
+class WavetableCache
+{
+private:
+    struct Entry
+    {
+        std::shared_ptr<const Wavetable> table;
+        std::uint64_t last_used;
+    };
+    std::map<WavetableKey, Entry> entries;
+    // banks handed out, by level 0 key; weak so they do not hold evicted tables, a bank still in use
+    // comes back as the same object
+    std::map<WavetableKey, std::weak_ptr<const WavetableBank>> banks;
+    std::size_t capacity;
+    std::uint64_t tick{ 0 };
+    std::uint64_t hit_count{ 0 };
+    std::uint64_t miss_count{ 0 };
+    std::uint64_t eviction_count{ 0 };
+    std::shared_ptr<const Wavetable> find(const WavetableKey& k);
+    void insert(const WavetableKey& k, std::shared_ptr<const Wavetable> table);
+public:
+    explicit WavetableCache(std::size_t capacity = 256);
+    static WavetableKey key(int waveform, float pw, int mip_level = 0);
+    std::shared_ptr<const Wavetable> get(int waveform, float pw, int mip_level = 0);
+    // every mip level of a waveform, the naive table is analysed once for all the levels that miss,
+    // canonical shapes at pulse width 0.5 come from the compiled in tables
+    std::shared_ptr<const WavetableBank> get_bank(int waveform, float pw);
+    void clear();
+    std::uint64_t hits() const { return hit_count; }
+    std::uint64_t misses() const { return miss_count; }
+    std::uint64_t evictions() const { return eviction_count; }
+    std::size_t size() const { return entries.size(); }
+    std::size_t bytes() const { return entries.size() * sizeof(Wavetable); }
+};
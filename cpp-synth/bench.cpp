@@ -0,0 +1,340 @@
+#include <stdio.h>
+#include <algorithm>
+#include <cmath>
+#include <chrono>
+#include <cstring>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Synth.h"
+#include "WavetableCache.h"
+
+// The DSP primitives on their own: table lookups, table generation and the envelope. Then whole
+// render blocks over a grid of voice counts and buffer sizes. Then the oscillator kernel comparison:
+// the float phase over 872-sample tables against the 32-bit fixed-point phase over the power of two
+// tables, one voice at a time and across voices, and the interpolation policies of the per-voice
+// kernel. Last, voice rendering spread over threads, which has to give the same output bits at every
+// thread count.
+//
+// The checks section makes sure parameter commands still reach the audio and fails the run when not.
+//
+//     cpp-synth-bench [--quick] [--json out.json] [checks] [primitives] [render] [kernels] [threads]
+//
+// Naming sections runs only those. --json writes every result with its ns/sample and samples/sec,
+// in a fixed order so two runs can be diffed.
+
+struct BenchResult
+{
+    std::string   name;
+    int           voices = 0;
+    unsigned long frames = 0;
+    double        ns_per_sample = 0;
+};
+
+static std::vector<BenchResult> results;
+// each timing runs at least this long, and the best of a few runs is kept
+static double run_seconds = 0.2;
+static volatile float sink;
+
+static void record(const std::string& name, int voices, unsigned long frames, double ns_per_sample) {
+    results.push_back({ name, voices, frames, ns_per_sample });
+}
+
+// nanoseconds per call of fn
+template <typename Fn>
+static double time_calls(Fn&& fn) {
+    using clock = std::chrono::steady_clock;
+    fn();
+    double best = 1e300;
+    for (int run = 0; run < 3; run++) {
+        std::size_t calls = 0;
+        const auto started = clock::now();
+        std::chrono::duration<double> elapsed{ 0 };
+        do {
+            fn();
+            ++calls;
+            elapsed = clock::now() - started;
+        } while (elapsed.count() < run_seconds);
+        best = std::min(best, elapsed.count() * 1e9 / (double)calls);
+    }
+    return best;
+}
+
+static void print_primitive(const char* name, double ns) {
+    printf("%-24s %8.2f ns/sample, %8.1f Msamples/s\n", name, ns, 1e3 / ns);
+    record(name, 0, 0, ns);
+}
+
+static void bench_primitives() {
+    printf("primitives\n");
+    Wavetable table;
+    gen_saw_wave(&table);
+    resample_fixed(&table);
+    constexpr int LOOKUPS = 4096;
+
+    // a few notes' worth of phase steps, so the lookups wander over the whole table
+    const float phase_inc = note_phase_inc(69);
+    double ns = time_calls([&] {
+        float phase = 0.0f, sum = 0.0f;
+        for (int i = 0; i < LOOKUPS; i++) {
+            sum += table.interpolate_at(phase);
+            phase += phase_inc;
+            if (phase >= TABLE_SIZE) phase -= TABLE_SIZE;
+        }
+        sink = sum;
+    });
+    print_primitive("interpolate_at", ns / LOOKUPS);
+
+    const std::uint32_t phase_inc_fx = fixed_phase_inc(phase_inc);
+    ns = time_calls([&] {
+        std::uint32_t phase = 0;
+        float sum = 0.0f;
+        for (int i = 0; i < LOOKUPS; i++) {
+            sum += table.interpolate_fixed(phase);
+            phase += phase_inc_fx;
+        }
+        sink = sum;
+    });
+    print_primitive("interpolate_fixed", ns / LOOKUPS);
+
+    // per table sample generated
+    print_primitive("gen_sin_wave", time_calls([&] { gen_sin_wave(&table); sink = table[1]; }) / TABLE_SIZE);
+    print_primitive("gen_saw_wave", time_calls([&] { gen_saw_wave(&table); sink = table[1]; }) / TABLE_SIZE);
+    print_primitive("gen_sqr_wave", time_calls([&] { gen_sqr_wave(&table, 0.25f); sink = table[1]; }) / TABLE_SIZE);
+    print_primitive("gen_tri_wave", time_calls([&] { gen_tri_wave(&table, 0.25f); sink = table[1]; }) / TABLE_SIZE);
+    Spectrum spectrum;
+    analyse(table, &spectrum);
+    print_primitive("synthesise", time_calls([&] { synthesise(spectrum, mip_harmonics(0), &table); sink = table[1]; }) / TABLE_SIZE);
+
+    // a note through every stage: attack, decay, a stretch of sustain, release and idle
+    ADSR adsr;
+    adsr.attack_time = 10.0f;
+    adsr.decay_time = 50.0f;
+    adsr.sustain_amp = 0.6f;
+    adsr.release_time = 100.0f;
+    const std::uint64_t note = ms_to_samples(300.0f);
+    ns = time_calls([&] {
+        Envelope env;
+        env.key_on(0);
+        float sum = 0.0f;
+        for (std::uint64_t t = 0; t < note; t++) {
+            if (t == note / 2)
+                env.key_off(adsr, t);
+            sum += env.get_amp(adsr, t);
+        }
+        sink = sum;
+    });
+    print_primitive("Envelope::get_amp", ns / (double)note);
+}
+
+// whole blocks through Synth::render with the default kernels, every voice sounding all three oscillators
+static void bench_render_grid() {
+    printf("render blocks (%s kernels)\n", SIMD_TIER_NAMES[(int)runtime_simd_tier()]);
+    WavetableCache tables;
+    for (int voices : { 1, 8, 64, 256 }) {
+        for (unsigned long frames : { 32ul, 64ul, 512ul }) {
+            Synth st;
+            st.allocate_voices(voices);
+            for (int o = 0; o < OSC_COUNT; o++)
+                st.publish_table(o, tables.get_bank(o, 0.5f));
+            for (int v = 0; v < voices; v++)
+                st.note_on(36 + v % 48);
+            static float buffer[2 * MAX_BLOCK_SIZE];
+            const double ns = time_calls([&] { st.render(buffer, frames); }) / (double)frames;
+            const double deadline = 1e9 / SAMPLE_RATE;
+            printf("%3d voices %3lu frames %9.1f ns/sample, %8.2f Msamples/s, %5.1f%% load\n", voices, frames, ns,
+                1e3 / ns, 100.0 * ns / deadline);
+            record("render", voices, frames, ns);
+        }
+    }
+}
+
+// a held note's level has to follow a sustain command, false when it does not
+static bool check_sustain() {
+    Synth st;
+    WavetableCache tables;
+    st.allocate_voices(8);
+    const auto held_peak = [&](float sustain) {
+        for (int o = 0; o < OSC_COUNT; o++)
+            st.set_param(o, Param::sustain, sustain);
+        // long enough for the envelope and any glide to settle
+        static float buffer[2 * 4800];
+        float peak = 0.0f;
+        for (int b = 0; b < 10; b++) {
+            st.render(buffer, 4800);
+            peak = 0.0f;
+            for (float s : buffer)
+                peak = std::max(peak, std::fabs(s));
+        }
+        return peak;
+    };
+    for (int o = 0; o < OSC_COUNT; o++)
+        st.publish_table(o, tables.get_bank(1, 0.5f));
+    st.note_on(60);
+    const float high = held_peak(0.8f);
+    const float low = held_peak(0.1f);
+    // the level scales with sustain, 1/8 of it here
+    const bool ok = high > 0.0f && std::fabs(low / high - 0.125f) < 0.02f;
+    printf("sustain 0.8 -> 0.1: peak %.4f -> %.4f %s\n", high, low, ok ? "ok" : "WRONG");
+    return ok;
+}
+
+static bool write_json(const char* path) {
+    FILE* f = fopen(path, "w");
+    if (f == nullptr)
+        return false;
+    fprintf(f, "{\n  \"simd\": \"%s\",\n  \"cpus\": %u,\n  \"sample_rate\": %d,\n  \"results\": [",
+        SIMD_TIER_NAMES[(int)runtime_simd_tier()], std::thread::hardware_concurrency(), SAMPLE_RATE);
+    for (std::size_t i = 0; i < results.size(); i++) {
+        const BenchResult& r = results[i];
+        fprintf(f, "%s\n    { \"name\": \"%s\", \"voices\": %d, \"frames\": %lu, \"ns_per_sample\": %.3f, \"samples_per_sec\": %.0f }",
+            i ? "," : "", r.name.c_str(), r.voices, r.frames, r.ns_per_sample, r.ns_per_sample > 0 ? 1e9 / r.ns_per_sample : 0.0);
+    }
+    fprintf(f, "\n  ]\n}\n");
+    return fclose(f) == 0;
+}
+
+static double bench_kernel(Kernel kernel, SimdTier tier, Interpolation interpolation, int voices, unsigned long frames, int blocks) {
+    Synth st;
+    WavetableCache tables;
+    st.allocate_voices(voices);
+    st.voices.kernel = kernel;
+    st.voices.dsp = kernels_for(tier);
+    st.voices.interpolation = interpolation;
+    for (int o = 0; o < OSC_COUNT; o++)
+        st.publish_table(o, tables.get_bank(0, 0.5f));
+    for (int v = 0; v < voices; v++)
+        st.note_on(36 + v % 48);
+
+    static float buffer[2 * MAX_BLOCK_SIZE];
+    st.render(buffer, frames);
+    auto started = std::chrono::steady_clock::now();
+    for (int b = 0; b < blocks; b++)
+        st.render(buffer, frames);
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - started;
+    // per voice and output frame
+    return elapsed.count() / ((double)blocks * frames * voices);
+}
+
+static void bench_voices(int voices, unsigned long frames, int blocks) {
+    // share of the block deadline spent rendering
+    const double deadline = 1e9 / SAMPLE_RATE;
+    const SimdTier tier = runtime_simd_tier();
+    double reference = bench_kernel(Kernel::reference, tier, Interpolation::linear, voices, frames, blocks);
+    double fixed = bench_kernel(Kernel::fixed_point, tier, Interpolation::linear, voices, frames, blocks);
+    printf("%d voices, %lu frame blocks\n", voices, frames);
+    printf("reference:     %6.2f ns/voice-sample, %5.1f%% load\n", reference, 100.0 * reference * voices / deadline);
+    printf("fixed_point:   %6.2f ns/voice-sample, %5.1f%% load (%.2fx)\n", fixed, 100.0 * fixed * voices / deadline, reference / fixed);
+    record("kernel reference", voices, frames, reference);
+    record("kernel fixed_point", voices, frames, fixed);
+    for (int t = 0; t <= (int)tier; t++) {
+        double simd = bench_kernel(Kernel::simd, (SimdTier)t, Interpolation::linear, voices, frames, blocks);
+        printf("simd %-8s %6.2f ns/voice-sample, %5.1f%% load (%.2fx)\n", SIMD_TIER_NAMES[t], simd, 100.0 * simd * voices / deadline, reference / simd);
+        record(std::string("kernel simd ") + SIMD_TIER_NAMES[t], voices, frames, simd);
+    }
+    for (int i = 0; i < (int)std::size(INTERPOLATION_NAMES); i++) {
+        double fixed_interp = bench_kernel(Kernel::fixed_point, tier, (Interpolation)i, voices, frames, blocks);
+        printf("fixed %-7s %6.2f ns/voice-sample, %5.1f%% load (%.2fx)\n", INTERPOLATION_NAMES[i], fixed_interp, 100.0 * fixed_interp * voices / deadline, reference / fixed_interp);
+        record(std::string("kernel fixed ") + INTERPOLATION_NAMES[i], voices, frames, fixed_interp);
+    }
+}
+
+// the pool is kept full and new notes steal every block, so chunks and voices shift between threads.
+// out collects every block.
+static double bench_threads(std::size_t threads, int voices, unsigned long frames, int blocks, std::vector<float>& out) {
+    Synth st;
+    WavetableCache tables;
+    st.allocate_voices(voices);
+    st.set_render_threads(threads);
+    for (int o = 0; o < OSC_COUNT; o++)
+        st.publish_table(o, tables.get_bank(o, 0.5f));
+
+    static float buffer[2 * MAX_BLOCK_SIZE];
+    out.clear();
+    std::chrono::duration<double, std::nano> elapsed{ 0 };
+    for (int b = 0; b < blocks; b++) {
+        for (int n = 0; n < ((b < voices / 32) ? 32 : 4); n++)
+            st.note_on(24 + (b * 7 + n * 13) % 72);
+        auto started = std::chrono::steady_clock::now();
+        st.render(buffer, frames);
+        elapsed += std::chrono::steady_clock::now() - started;
+        out.insert(out.end(), buffer, buffer + 2 * frames);
+    }
+    if (threads == 1) {
+        // per node timing from the scheduler: the mixdown, the patch nodes, then the voice chunks
+        const auto average_us = [](const TaskNode& node) { return node.total_ns.load() / 1000.0 / std::max<std::uint64_t>(node.runs.load(), 1); };
+        const std::size_t patch_nodes = st.patch_nodes.load();
+        std::uint64_t voice_ns = 0, voice_runs = 0;
+        for (std::size_t n = 1 + patch_nodes; n < st.graph_nodes.load(); n++) {
+            voice_ns += st.graph_node(n).total_ns.load();
+            voice_runs += st.graph_node(n).runs.load();
+        }
+        printf("graph: %zu nodes, voice chunk %.2f us, mixdown %.2f us", st.graph_nodes.load(),
+            voice_ns / 1000.0 / std::max<std::uint64_t>(voice_runs, 1), average_us(st.graph_node(0)));
+        for (std::size_t n = 1; n <= patch_nodes; n++)
+            printf(", %s %.2f us", st.graph_node(n).name, average_us(st.graph_node(n)));
+        printf("\n");
+    }
+    return elapsed.count() / ((double)blocks * frames);
+}
+
+static void bench_thread_counts(int voices, unsigned long frames, int blocks) {
+    printf("%d voices, %lu frame blocks, %u cpus\n", voices, frames, std::thread::hardware_concurrency());
+    const double deadline = 1e9 / SAMPLE_RATE;
+    std::vector<float> single, multi;
+    double base = bench_threads(1, voices, frames, blocks, single);
+    printf("1 thread:    %6.1f ns/sample, %5.1f%% load\n", base, 100.0 * base / deadline);
+    record("threads 1", voices, frames, base);
+    for (std::size_t t = 2; t <= std::max(4u, std::thread::hardware_concurrency()) && t <= 8; t *= 2) {
+        double ns = bench_threads(t, voices, frames, blocks, multi);
+        bool same = multi.size() == single.size() && std::memcmp(multi.data(), single.data(), single.size() * sizeof(float)) == 0;
+        printf("%zu threads:  %6.1f ns/sample, %5.1f%% load (%.2fx) output %s\n", t, ns, 100.0 * ns / deadline, base / ns,
+            same ? "bit-identical" : "DIFFERS");
+        record("threads " + std::to_string(t), voices, frames, ns);
+    }
+}
+
+int main(int argc, char** argv) {
+    const char* json_path = nullptr;
+    bool quick = false;
+    std::vector<std::string> sections;
+    for (int a = 1; a < argc; a++) {
+        if (!strcmp(argv[a], "--json") && a + 1 < argc)
+            json_path = argv[++a];
+        else if (!strcmp(argv[a], "--quick"))
+            quick = true;
+        else if (!strcmp(argv[a], "checks") || !strcmp(argv[a], "primitives") || !strcmp(argv[a], "render") || !strcmp(argv[a], "kernels") || !strcmp(argv[a], "threads"))
+            sections.push_back(argv[a]);
+        else {
+            fprintf(stderr, "usage: %s [--quick] [--json out.json] [checks] [primitives] [render] [kernels] [threads]\n", argv[0]);
+            return 1;
+        }
+    }
+    const auto wanted = [&](const char* section) {
+        return sections.empty() || std::find(sections.begin(), sections.end(), section) != sections.end();
+    };
+    // a quick run is for checking the bench still works, not for numbers
+    const int scale = quick ? 10 : 1;
+    if (quick)
+        run_seconds = 0.02;
+
+    printf("detected %s, using up to %s\n", SIMD_TIER_NAMES[(int)detected_simd_tier()], SIMD_TIER_NAMES[(int)runtime_simd_tier()]);
+    if (wanted("checks") && !check_sustain())
+        return 1;
+    if (wanted("primitives"))
+        bench_primitives();
+    if (wanted("render"))
+        bench_render_grid();
+    if (wanted("kernels")) {
+        bench_voices(64, 64, 4000 / scale);
+        bench_voices(256, 64, 1000 / scale);
+    }
+    if (wanted("threads"))
+        bench_thread_counts(256, 64, 2000 / scale);
+    if (json_path && !write_json(json_path)) {
+        fprintf(stderr, "Could not write %s\n", json_path);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,121 @@
+#include <array>
+#include "builtin_tables.h"
+
+namespace {
+    using BuiltinLevels = std::array<Wavetable, MIP_LEVELS>;
+
+    // sine of 2 pi i / N
+    template <int N>
+    struct SineGrid
+    {
+        double s[N]{};
+        constexpr SineGrid() {
+            for (int i = 0; i < N; i++)
+                s[i] = const_sin(2 * std::numbers::pi * i / N);
+        }
+    };
+
+    // Fourier series of the naive shapes gen_waveform draws. Each is a sine or a cosine series,
+    // the cosine one starts its index a quarter cycle in.
+    constexpr double series_coefficient(int waveform, int h) {
+        constexpr double pi = std::numbers::pi;
+        switch (waveform)
+        {
+            case 0: return ((h & 1) ? 2.0 : -2.0) / (pi * h);
+            case 1: return (h == 1) ? 1.0 : 0.0;
+            case 2: return (h & 1) ? 4.0 / (pi * h) : 0.0;
+            case 3: return (h & 1) ? -8.0 / (pi * pi * h * h) : 0.0;
+            default: return 0.0;
+        }
+    }
+
+    // odd shapes are sine series, the triangle is a cosine series and even about zero
+    constexpr bool odd_shape(int waveform) { return waveform != 3; }
+
+    template <int N>
+    struct LevelGrid
+    {
+        float v[MIP_LEVELS][N]{};
+    };
+
+    // Band-limited samples of every level on an N point grid. Starting from the top level, each
+    // lower one adds the harmonics it has room for to running sums, and only the first half cycle
+    // is summed, the rest follows from the symmetry of the shape.
+    template <int N>
+    constexpr LevelGrid<N> make_grid(int waveform) {
+        constexpr SineGrid<N> grid;
+        const int start = odd_shape(waveform) ? 0 : N / 4;
+        LevelGrid<N> out{};
+        double sum[N / 2 + 1]{};
+        int done = 0;
+        for (int level = MIP_LEVELS - 1; level >= 0; level--) {
+            const int harmonics = mip_harmonics(level);
+            for (int h = done + 1; h <= harmonics; h++) {
+                const double a = series_coefficient(waveform, h);
+                if (a == 0)
+                    continue;
+                // h < N, so the index wraps at most once per step
+                for (int i = 0, idx = start; i <= N / 2; i++) {
+                    sum[i] += a * grid.s[idx];
+                    idx += h;
+                    if (idx >= N) idx -= N;
+                }
+            }
+            done = harmonics;
+            for (int i = 0; i <= N / 2; i++)
+                out.v[level][i] = (float)sum[i];
+            for (int i = N / 2 + 1; i < N; i++)
+                out.v[level][i] = odd_shape(waveform) ? -out.v[level][N - i] : out.v[level][N - i];
+        }
+        return out;
+    }
+
+    constexpr BuiltinLevels make_levels(const LevelGrid<TABLE_SIZE>& data, const LevelGrid<FIXED_TABLE_SIZE>& fixed) {
+        BuiltinLevels levels{};
+        for (int level = 0; level < MIP_LEVELS; level++) {
+            for (int i = 0; i < TABLE_SIZE; i++)
+                levels[level].data[i] = data.v[level][i];
+            for (int i = 0; i < FIXED_TABLE_SIZE; i++)
+                levels[level].fixed[i] = fixed.v[level][i];
+            levels[level].fixed[FIXED_TABLE_SIZE] = levels[level].fixed[0];
+        }
+        return levels;
+    }
+
+    // every grid is its own constant so each evaluation stays inside the compiler's step limits
+    constexpr LevelGrid<TABLE_SIZE> SAW_DATA = make_grid<TABLE_SIZE>(0);
+    constexpr LevelGrid<FIXED_TABLE_SIZE> SAW_FIXED = make_grid<FIXED_TABLE_SIZE>(0);
+    constexpr LevelGrid<TABLE_SIZE> SINE_DATA = make_grid<TABLE_SIZE>(1);
+    constexpr LevelGrid<FIXED_TABLE_SIZE> SINE_FIXED = make_grid<FIXED_TABLE_SIZE>(1);
+    constexpr LevelGrid<TABLE_SIZE> SQUARE_DATA = make_grid<TABLE_SIZE>(2);
+    constexpr LevelGrid<FIXED_TABLE_SIZE> SQUARE_FIXED = make_grid<FIXED_TABLE_SIZE>(2);
+    constexpr LevelGrid<TABLE_SIZE> TRIANGLE_DATA = make_grid<TABLE_SIZE>(3);
+    constexpr LevelGrid<FIXED_TABLE_SIZE> TRIANGLE_FIXED = make_grid<FIXED_TABLE_SIZE>(3);
+
+    constexpr BuiltinLevels BUILTIN_SAW = make_levels(SAW_DATA, SAW_FIXED);
+    constexpr BuiltinLevels BUILTIN_SINE = make_levels(SINE_DATA, SINE_FIXED);
+    constexpr BuiltinLevels BUILTIN_SQUARE = make_levels(SQUARE_DATA, SQUARE_FIXED);
+    constexpr BuiltinLevels BUILTIN_TRIANGLE = make_levels(TRIANGLE_DATA, TRIANGLE_FIXED);
+    constexpr const BuiltinLevels* BUILTIN[BUILTIN_WAVEFORMS] = { &BUILTIN_SAW, &BUILTIN_SINE, &BUILTIN_SQUARE, &BUILTIN_TRIANGLE };
+}
+
+const Wavetable& builtin_table(int waveform, int mip_level) {
+    return (*BUILTIN[waveform])[mip_level];
+}
+
+std::shared_ptr<const WavetableBank> builtin_bank(int waveform) {
+    if (waveform < 0 || waveform >= BUILTIN_WAVEFORMS)
+        return nullptr;
+    // the banks only point at the static tables, they own nothing
+    static const auto banks = [] {
+        std::array<std::shared_ptr<const WavetableBank>, BUILTIN_WAVEFORMS> out;
+        for (int w = 0; w < BUILTIN_WAVEFORMS; w++) {
+            auto bank = std::make_shared<WavetableBank>();
+            for (int level = 0; level < MIP_LEVELS; level++)
+                bank->levels[level] = std::shared_ptr<const Wavetable>(std::shared_ptr<const Wavetable>(), &builtin_table(w, level));
+            out[w] = std::move(bank);
+        }
+        return out;
+    }();
+    return banks[waveform];
+}
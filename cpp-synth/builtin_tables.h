@@ -0,0 +1,35 @@
+#pragma once
+#include <memory>
+#include <numbers>
+#include "wavetable.h"
+
+// waveforms 0 to BUILTIN_WAVEFORMS - 1 have their canonical shape compiled in
+constexpr auto BUILTIN_WAVEFORMS = 4;
+
+// sine for constant evaluation, reduced to [-pi/2, pi/2] where the series is good to double precision
+constexpr double const_sin(double x)
+{
+    constexpr double pi = std::numbers::pi;
+    const double turns = x / (2 * pi);
+    const long long n = (long long)(turns < 0 ? turns - 0.5 : turns + 0.5);
+    x -= (double)n * 2 * pi;
+    if (x > pi / 2)
+        x = pi - x;
+    else if (x < -pi / 2)
+        x = -pi - x;
+    double term = x, sum = x;
+    for (int k = 1; k < 12; k++) {
+        term *= -x * x / ((2 * k) * (2 * k + 1));
+        sum += term;
+    }
+    return sum;
+}
+
+constexpr double const_cos(double x)
+{
+    return const_sin(x + std::numbers::pi / 2);
+}
+
+// every mip level of a canonical waveform at pulse width 0.5, the tables live in read-only data
+std::shared_ptr<const WavetableBank> builtin_bank(int waveform);
+const Wavetable& builtin_table(int waveform, int mip_level);
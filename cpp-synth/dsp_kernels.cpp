@@ -0,0 +1,430 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iterator>
+#include "dsp_kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define SYNTH_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// the whole build stays at the baseline ISA, wider kernels are compiled per function
+#if defined(__GNUC__) || defined(__clang__)
+#define SYNTH_TARGET(isa) __attribute__((target(isa)))
+#else
+#define SYNTH_TARGET(isa)
+#endif
+
+namespace {
+    constexpr float FRAC_SCALE = 1.0f / (1u << FIXED_FRAC_BITS);
+    constexpr std::uint32_t FRAC_MASK = (1u << FIXED_FRAC_BITS) - 1;
+
+    void render_lanes_scalar(OscGroup& group, int first, int count, unsigned long frames, LaneMix& mix) {
+        for (int lane = first; lane < first + count; lane++) {
+            const float* table = group.tables[lane];
+            std::uint32_t left_phase = group.left_phase[lane];
+            std::uint32_t right_phase = group.right_phase[lane];
+            const std::uint32_t inc = group.phase_inc[lane];
+            for (unsigned long f = 0; f < frames; f++) {
+                const float env = group.env[f * LANE_GROUP + lane];
+                std::uint32_t i = left_phase >> FIXED_FRAC_BITS;
+                float frac = (float)(left_phase & FRAC_MASK) * FRAC_SCALE;
+                mix.left[f * LANE_GROUP + lane] += env * (table[i] + frac * (table[i + 1] - table[i]));
+                i = right_phase >> FIXED_FRAC_BITS;
+                frac = (float)(right_phase & FRAC_MASK) * FRAC_SCALE;
+                mix.right[f * LANE_GROUP + lane] += env * (table[i] + frac * (table[i + 1] - table[i]));
+                left_phase += inc;
+                right_phase += inc;
+            }
+            group.left_phase[lane] = left_phase;
+            group.right_phase[lane] = right_phase;
+        }
+    }
+
+    void render_group_scalar(OscGroup& group, unsigned long frames, LaneMix& mix) {
+        render_lanes_scalar(group, 0, LANE_GROUP, frames, mix);
+    }
+
+    void reduce_scalar(const LaneMix& mix, float* left, float* right, unsigned long frames) {
+        for (unsigned long f = 0; f < frames; f++) {
+            float l = 0.0f, r = 0.0f;
+            for (int lane = 0; lane < LANE_GROUP; lane++) {
+                l += mix.left[f * LANE_GROUP + lane];
+                r += mix.right[f * LANE_GROUP + lane];
+            }
+            left[f] += l;
+            right[f] += r;
+        }
+    }
+
+    // gathers address the tables as 32-bit float offsets from the first lane's table
+    bool table_offsets(const float* const* tables, int count, std::int32_t* offsets) {
+        const std::intptr_t base = (std::intptr_t)tables[0];
+        for (int lane = 0; lane < count; lane++) {
+            const std::intptr_t diff = ((std::intptr_t)tables[lane] - base) / (std::intptr_t)sizeof(float);
+            if (diff < INT32_MIN || diff > INT32_MAX - (FIXED_TABLE_SIZE + 1))
+                return false;
+            offsets[lane] = (std::int32_t)diff;
+        }
+        return true;
+    }
+
+#ifdef SYNTH_X86
+    // SSE2 has no gather, the four table reads are scalar loads
+    SYNTH_TARGET("sse2")
+    inline __m128 lerp_sse2(const float* const* tables, __m128i phase) {
+        alignas(16) std::uint32_t idx[4];
+        _mm_store_si128((__m128i*)idx, _mm_srli_epi32(phase, FIXED_FRAC_BITS));
+        __m128 a = _mm_setr_ps(tables[0][idx[0]], tables[1][idx[1]], tables[2][idx[2]], tables[3][idx[3]]);
+        __m128 b = _mm_setr_ps(tables[0][idx[0] + 1], tables[1][idx[1] + 1], tables[2][idx[2] + 1], tables[3][idx[3] + 1]);
+        __m128 frac = _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(phase, _mm_set1_epi32(FRAC_MASK))), _mm_set1_ps(FRAC_SCALE));
+        return _mm_add_ps(a, _mm_mul_ps(frac, _mm_sub_ps(b, a)));
+    }
+
+    SYNTH_TARGET("sse2")
+    void render_group_sse2(OscGroup& group, unsigned long frames, LaneMix& mix) {
+        for (int base = 0; base < LANE_GROUP; base += 4) {
+            __m128i left_phase = _mm_loadu_si128((const __m128i*)&group.left_phase[base]);
+            __m128i right_phase = _mm_loadu_si128((const __m128i*)&group.right_phase[base]);
+            const __m128i inc = _mm_loadu_si128((const __m128i*)&group.phase_inc[base]);
+            for (unsigned long f = 0; f < frames; f++) {
+                const std::size_t at = f * LANE_GROUP + base;
+                const __m128 env = _mm_load_ps(&group.env[at]);
+                _mm_store_ps(&mix.left[at], _mm_add_ps(_mm_load_ps(&mix.left[at]), _mm_mul_ps(env, lerp_sse2(&group.tables[base], left_phase))));
+                _mm_store_ps(&mix.right[at], _mm_add_ps(_mm_load_ps(&mix.right[at]), _mm_mul_ps(env, lerp_sse2(&group.tables[base], right_phase))));
+                left_phase = _mm_add_epi32(left_phase, inc);
+                right_phase = _mm_add_epi32(right_phase, inc);
+            }
+            _mm_storeu_si128((__m128i*)&group.left_phase[base], left_phase);
+            _mm_storeu_si128((__m128i*)&group.right_phase[base], right_phase);
+        }
+    }
+
+    SYNTH_TARGET("sse2")
+    inline float sum_sse2(__m128 v) {
+        v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+        v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 1));
+        return _mm_cvtss_f32(v);
+    }
+
+    SYNTH_TARGET("sse2")
+    void reduce_sse2(const LaneMix& mix, float* left, float* right, unsigned long frames) {
+        for (unsigned long f = 0; f < frames; f++) {
+            const float* l = &mix.left[f * LANE_GROUP];
+            const float* r = &mix.right[f * LANE_GROUP];
+            __m128 lsum = _mm_add_ps(_mm_add_ps(_mm_load_ps(l), _mm_load_ps(l + 4)), _mm_add_ps(_mm_load_ps(l + 8), _mm_load_ps(l + 12)));
+            __m128 rsum = _mm_add_ps(_mm_add_ps(_mm_load_ps(r), _mm_load_ps(r + 4)), _mm_add_ps(_mm_load_ps(r + 8), _mm_load_ps(r + 12)));
+            left[f] += sum_sse2(lsum);
+            right[f] += sum_sse2(rsum);
+        }
+    }
+
+    SYNTH_TARGET("avx2,fma")
+    inline __m256 lerp_avx2(const float* base, __m256i offsets, __m256i phase) {
+        const __m256i idx = _mm256_add_epi32(offsets, _mm256_srli_epi32(phase, FIXED_FRAC_BITS));
+        const __m256 a = _mm256_i32gather_ps(base, idx, 4);
+        const __m256 b = _mm256_i32gather_ps(base + 1, idx, 4);
+        const __m256 frac = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(phase, _mm256_set1_epi32(FRAC_MASK))), _mm256_set1_ps(FRAC_SCALE));
+        return _mm256_fmadd_ps(frac, _mm256_sub_ps(b, a), a);
+    }
+
+    SYNTH_TARGET("avx2,fma")
+    void render_group_avx2(OscGroup& group, unsigned long frames, LaneMix& mix) {
+        for (int base = 0; base < LANE_GROUP; base += 8) {
+            alignas(32) std::int32_t lane_offsets[8];
+            if (!table_offsets(&group.tables[base], 8, lane_offsets)) {
+                // tables too far apart in memory for 32-bit gather offsets
+                render_lanes_scalar(group, base, 8, frames, mix);
+                continue;
+            }
+            const float* table = group.tables[base];
+            const __m256i offsets = _mm256_load_si256((const __m256i*)lane_offsets);
+            __m256i left_phase = _mm256_loadu_si256((const __m256i*)&group.left_phase[base]);
+            __m256i right_phase = _mm256_loadu_si256((const __m256i*)&group.right_phase[base]);
+            const __m256i inc = _mm256_loadu_si256((const __m256i*)&group.phase_inc[base]);
+            for (unsigned long f = 0; f < frames; f++) {
+                const std::size_t at = f * LANE_GROUP + base;
+                const __m256 env = _mm256_load_ps(&group.env[at]);
+                _mm256_store_ps(&mix.left[at], _mm256_fmadd_ps(env, lerp_avx2(table, offsets, left_phase), _mm256_load_ps(&mix.left[at])));
+                _mm256_store_ps(&mix.right[at], _mm256_fmadd_ps(env, lerp_avx2(table, offsets, right_phase), _mm256_load_ps(&mix.right[at])));
+                left_phase = _mm256_add_epi32(left_phase, inc);
+                right_phase = _mm256_add_epi32(right_phase, inc);
+            }
+            _mm256_storeu_si256((__m256i*)&group.left_phase[base], left_phase);
+            _mm256_storeu_si256((__m256i*)&group.right_phase[base], right_phase);
+        }
+    }
+
+    SYNTH_TARGET("avx2,fma")
+    void reduce_avx2(const LaneMix& mix, float* left, float* right, unsigned long frames) {
+        for (unsigned long f = 0; f < frames; f++) {
+            const float* l = &mix.left[f * LANE_GROUP];
+            const float* r = &mix.right[f * LANE_GROUP];
+            __m256 lsum = _mm256_add_ps(_mm256_load_ps(l), _mm256_load_ps(l + 8));
+            __m256 rsum = _mm256_add_ps(_mm256_load_ps(r), _mm256_load_ps(r + 8));
+            left[f] += sum_sse2(_mm_add_ps(_mm256_castps256_ps128(lsum), _mm256_extractf128_ps(lsum, 1)));
+            right[f] += sum_sse2(_mm_add_ps(_mm256_castps256_ps128(rsum), _mm256_extractf128_ps(rsum, 1)));
+        }
+    }
+
+#if defined(__GNUC__) && !defined(__clang__)
+    // gcc's avx512 headers pass undefined vectors as the unused merge sources, which -Wextra then
+    // reports as maybe uninitialized once inlined here
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+    // one group is exactly one 16-wide vector
+    SYNTH_TARGET("avx512f")
+    inline __m512 lerp_avx512(const float* base, __m512i offsets, __m512i phase) {
+        const __m512i idx = _mm512_add_epi32(offsets, _mm512_srli_epi32(phase, FIXED_FRAC_BITS));
+        const __m512 a = _mm512_i32gather_ps(idx, base, 4);
+        const __m512 b = _mm512_i32gather_ps(idx, base + 1, 4);
+        const __m512 frac = _mm512_mul_ps(_mm512_cvtepi32_ps(_mm512_and_si512(phase, _mm512_set1_epi32(FRAC_MASK))), _mm512_set1_ps(FRAC_SCALE));
+        return _mm512_fmadd_ps(frac, _mm512_sub_ps(b, a), a);
+    }
+
+    SYNTH_TARGET("avx512f")
+    void render_group_avx512(OscGroup& group, unsigned long frames, LaneMix& mix) {
+        alignas(64) std::int32_t lane_offsets[LANE_GROUP];
+        if (!table_offsets(group.tables, LANE_GROUP, lane_offsets)) {
+            render_lanes_scalar(group, 0, LANE_GROUP, frames, mix);
+            return;
+        }
+        const float* table = group.tables[0];
+        const __m512i offsets = _mm512_load_si512(lane_offsets);
+        __m512i left_phase = _mm512_loadu_si512(group.left_phase);
+        __m512i right_phase = _mm512_loadu_si512(group.right_phase);
+        const __m512i inc = _mm512_loadu_si512(group.phase_inc);
+        for (unsigned long f = 0; f < frames; f++) {
+            const std::size_t at = f * LANE_GROUP;
+            const __m512 env = _mm512_load_ps(&group.env[at]);
+            _mm512_store_ps(&mix.left[at], _mm512_fmadd_ps(env, lerp_avx512(table, offsets, left_phase), _mm512_load_ps(&mix.left[at])));
+            _mm512_store_ps(&mix.right[at], _mm512_fmadd_ps(env, lerp_avx512(table, offsets, right_phase), _mm512_load_ps(&mix.right[at])));
+            left_phase = _mm512_add_epi32(left_phase, inc);
+            right_phase = _mm512_add_epi32(right_phase, inc);
+        }
+        _mm512_storeu_si512(group.left_phase, left_phase);
+        _mm512_storeu_si512(group.right_phase, right_phase);
+    }
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif
+
+    constexpr std::uint32_t TABLE_MASK = FIXED_TABLE_SIZE - 1;
+
+    // interpolation policies, each reads one sample of a fixed table at a 32-bit phase
+    struct NoInterpolation
+    {
+        static float at(const float* table, std::uint32_t phase) {
+            return table[phase >> FIXED_FRAC_BITS];
+        }
+    };
+
+    struct LinearInterpolation
+    {
+        // the guard sample at the end of the table saves the wrap
+        static float at(const float* table, std::uint32_t phase) {
+            const std::uint32_t i = phase >> FIXED_FRAC_BITS;
+            const float frac = (float)(phase & FRAC_MASK) * FRAC_SCALE;
+            return table[i] + frac * (table[i + 1] - table[i]);
+        }
+    };
+
+    struct CubicInterpolation
+    {
+        // 4-point Catmull-Rom spline
+        static float at(const float* table, std::uint32_t phase) {
+            const std::uint32_t i = phase >> FIXED_FRAC_BITS;
+            const float t = (float)(phase & FRAC_MASK) * FRAC_SCALE;
+            const float y0 = table[(i - 1) & TABLE_MASK], y1 = table[i];
+            const float y2 = table[i + 1], y3 = table[(i + 2) & TABLE_MASK];
+            const float c1 = 0.5f * (y2 - y0);
+            const float c2 = y0 - 2.5f * y1 + 2.0f * y2 - 0.5f * y3;
+            const float c3 = 0.5f * (y3 - y0) + 1.5f * (y1 - y2);
+            return ((c3 * t + c2) * t + c1) * t + y1;
+        }
+    };
+
+    // Blackman windowed sinc, one row of taps per step of the top SINC_PHASE_BITS of the fraction
+    constexpr int SINC_TAPS = 8;
+    constexpr int SINC_PHASE_BITS = 8;
+
+    struct SincTable
+    {
+        alignas(32) float taps[1 << SINC_PHASE_BITS][SINC_TAPS];
+        SincTable() {
+            for (int p = 0; p < (1 << SINC_PHASE_BITS); p++) {
+                const double frac = (double)p / (1 << SINC_PHASE_BITS);
+                double sum = 0;
+                for (int k = 0; k < SINC_TAPS; k++) {
+                    const double x = k - (SINC_TAPS / 2 - 1) - frac;
+                    const double sinc = (x == 0) ? 1.0 : std::sin(M_PI * x) / (M_PI * x);
+                    const double w = (x + SINC_TAPS / 2) / SINC_TAPS;
+                    const double window = 0.42 - 0.5 * std::cos(2 * M_PI * w) + 0.08 * std::cos(4 * M_PI * w);
+                    taps[p][k] = (float)(sinc * window);
+                    sum += taps[p][k];
+                }
+                // unity gain at dc for every fraction
+                for (int k = 0; k < SINC_TAPS; k++)
+                    taps[p][k] = (float)(taps[p][k] / sum);
+            }
+        }
+    };
+
+    const SincTable sinc_table;
+
+    struct SincInterpolation
+    {
+        static float at(const float* table, std::uint32_t phase) {
+            const std::uint32_t i = phase >> FIXED_FRAC_BITS;
+            const float* taps = sinc_table.taps[(phase & FRAC_MASK) >> (FIXED_FRAC_BITS - SINC_PHASE_BITS)];
+            float sum = 0.0f;
+            for (int k = 0; k < SINC_TAPS; k++)
+                sum += taps[k] * table[(i + k - (SINC_TAPS / 2 - 1)) & TABLE_MASK];
+            return sum;
+        }
+    };
+
+    template <typename Interp, PhaseMode mode>
+    void render_layer(const float* table, std::uint32_t& left_phase, std::uint32_t& right_phase, std::uint32_t phase_inc,
+                      const float* amp, float* left, float* right, unsigned long frames) {
+        std::uint32_t lp = left_phase, rp = right_phase;
+        for (unsigned long i = 0; i < frames; i++) {
+            const float l = Interp::at(table, lp);
+            left[i] += amp[i] * l;
+            if constexpr (mode == PhaseMode::linked)
+                right[i] += amp[i] * l;
+            else
+                right[i] += amp[i] * Interp::at(table, rp);
+            // wrap is the overflow of the 32-bit phase
+            lp += phase_inc;
+            rp += phase_inc;
+        }
+        left_phase = lp;
+        right_phase = rp;
+    }
+
+    template <typename Interp>
+    constexpr LayerKernel LAYER_KERNELS[] = { render_layer<Interp, PhaseMode::linked>, render_layer<Interp, PhaseMode::independent> };
+
+    bool parse_tier(const char* name, SimdTier* tier) {
+        for (int t = 0; t < (int)std::size(SIMD_TIER_NAMES); t++) {
+            if (std::strcmp(name, SIMD_TIER_NAMES[t]) == 0) {
+                *tier = (SimdTier)t;
+                return true;
+            }
+        }
+        return false;
+    }
+}
+
+void LaneMix::clear(unsigned long frames) {
+    std::fill_n(left, frames * LANE_GROUP, 0.0f);
+    std::fill_n(right, frames * LANE_GROUP, 0.0f);
+}
+
+SimdTier detected_simd_tier() {
+#if defined(SYNTH_X86) && (defined(__GNUC__) || defined(__clang__))
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return SimdTier::avx512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return SimdTier::avx2;
+    if (__builtin_cpu_supports("sse2"))
+        return SimdTier::sse2;
+    return SimdTier::scalar;
+#elif defined(SYNTH_X86) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    const int max_leaf = info[0];
+    __cpuid(info, 1);
+    const bool sse2 = (info[3] & (1 << 26)) != 0;
+    const bool fma = (info[2] & (1 << 12)) != 0;
+    // the OS has to save the ymm and zmm registers too
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    const unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+    bool avx2 = false, avx512 = false;
+    if (max_leaf >= 7) {
+        __cpuidex(info, 7, 0);
+        avx2 = (info[1] & (1 << 5)) != 0 && (xcr0 & 0x6) == 0x6;
+        avx512 = (info[1] & (1 << 16)) != 0 && (xcr0 & 0xe6) == 0xe6;
+    }
+    if (avx512)
+        return SimdTier::avx512;
+    if (avx2 && fma)
+        return SimdTier::avx2;
+    return sse2 ? SimdTier::sse2 : SimdTier::scalar;
+#else
+    return SimdTier::scalar;
+#endif
+}
+
+SimdTier runtime_simd_tier() {
+    static const SimdTier tier = [] {
+        SimdTier best = detected_simd_tier();
+        const char* forced = getenv("SYNTH_SIMD");
+        if (forced == nullptr || *forced == '\0')
+            return best;
+        SimdTier want;
+        if (!parse_tier(forced, &want)) {
+            fprintf(stderr, "SYNTH_SIMD=%s not recognised, using %s\n", forced, SIMD_TIER_NAMES[(int)best]);
+            return best;
+        }
+        if (want > best) {
+            fprintf(stderr, "SYNTH_SIMD=%s not supported on this CPU, using %s\n", forced, SIMD_TIER_NAMES[(int)best]);
+            return best;
+        }
+        return want;
+    }();
+    return tier;
+}
+
+bool simd_tier_supported(SimdTier tier) {
+    return tier <= detected_simd_tier();
+}
+
+DspKernels kernels_for(SimdTier tier) {
+    tier = std::min(tier, detected_simd_tier());
+    DspKernels k;
+    k.tier = tier;
+    k.render_group = render_group_scalar;
+    k.reduce = reduce_scalar;
+#ifdef SYNTH_X86
+    switch (tier)
+    {
+        case SimdTier::avx512:
+            k.render_group = render_group_avx512;
+            k.reduce = reduce_avx2;
+            break;
+        case SimdTier::avx2:
+            k.render_group = render_group_avx2;
+            k.reduce = reduce_avx2;
+            break;
+        case SimdTier::sse2:
+            k.render_group = render_group_sse2;
+            k.reduce = reduce_sse2;
+            break;
+        default:
+            break;
+    }
+#endif
+    return k;
+}
+
+LayerKernel layer_kernel(Interpolation interpolation, PhaseMode mode) {
+    const int m = (int)mode;
+    switch (interpolation)
+    {
+        case Interpolation::none:  return LAYER_KERNELS<NoInterpolation>[m];
+        case Interpolation::cubic: return LAYER_KERNELS<CubicInterpolation>[m];
+        case Interpolation::sinc:  return LAYER_KERNELS<SincInterpolation>[m];
+        default:                   return LAYER_KERNELS<LinearInterpolation>[m];
+    }
+}
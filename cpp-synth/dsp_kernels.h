@@ -0,0 +1,65 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include "wavetable.h"
+
+// voice layers are rendered this many at a time, the widest vector any kernel uses
+constexpr auto LANE_GROUP = 16;
+
+// Structure-of-arrays state for up to LANE_GROUP voice layers. Unused lanes have a zero
+// envelope and increment. env and the lane mixes are frame major: [frame * LANE_GROUP + lane].
+struct OscGroup
+{
+    const float*  tables[LANE_GROUP];
+    std::uint32_t left_phase[LANE_GROUP];
+    std::uint32_t right_phase[LANE_GROUP];
+    std::uint32_t phase_inc[LANE_GROUP];
+    // gain of each lane per frame, LANE_GROUP lanes to a frame, 64-byte aligned
+    float*        env = nullptr;
+};
+
+// lane-wise mix of every group rendered in a block, summed across lanes once at the end
+struct LaneMix
+{
+    alignas(64) float left[MAX_BLOCK_SIZE * LANE_GROUP];
+    alignas(64) float right[MAX_BLOCK_SIZE * LANE_GROUP];
+    void clear(unsigned long frames);
+};
+
+// instruction set levels with their own kernels, in increasing order
+enum class SimdTier { scalar, sse2, avx2, avx512 };
+
+// names in SimdTier order, also the values SYNTH_SIMD accepts
+constexpr const char* SIMD_TIER_NAMES[] = { "scalar", "sse2", "avx2", "avx512" };
+
+// Kernels for one tier. render_group runs the fixed-point oscillators over the power of two
+// tables times the envelope into the lane mix and advances the phases past the block,
+// reduce adds the lane mix into planar left and right buffers.
+struct DspKernels
+{
+    SimdTier tier = SimdTier::scalar;
+    void     (*render_group)(OscGroup& group, unsigned long frames, LaneMix& mix) = nullptr;
+    void     (*reduce)(const LaneMix& mix, float* left, float* right, unsigned long frames) = nullptr;
+};
+
+// highest tier this CPU and build support, avx2 also needs FMA
+SimdTier detected_simd_tier();
+// detected tier unless SYNTH_SIMD asks for a lower one, worked out once
+SimdTier runtime_simd_tier();
+bool     simd_tier_supported(SimdTier tier);
+// kernels for a tier, falls back to the best supported tier below it
+DspKernels kernels_for(SimdTier tier);
+
+// table lookup of the per-voice fixed-point kernels
+enum class Interpolation { none, linear, cubic, sinc };
+constexpr const char* INTERPOLATION_NAMES[] = { "none", "linear", "cubic", "sinc" };
+
+// linked: both channels read the one phase, independent: left and right phases differ
+enum class PhaseMode { linked, independent };
+
+// One oscillator layer over a power of two table: amp times the table at each phase added into
+// the planar mix, phases advanced past the block. There is one instantiation per interpolation
+// and phase mode, picked once per block.
+using LayerKernel = void (*)(const float* table, std::uint32_t& left_phase, std::uint32_t& right_phase, std::uint32_t phase_inc,
+                             const float* amp, float* left, float* right, unsigned long frames);
+LayerKernel layer_kernel(Interpolation interpolation, PhaseMode mode);
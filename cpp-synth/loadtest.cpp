@@ -0,0 +1,268 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "AudioBackend.h"
+#include "Synth.h"
+#include "WavetableCache.h"
+
+// Capacity of this machine: the engine runs behind a NullBackend with a growing number of voices
+// until the p99.9 block time passes the budget, a share of the buffer period. The voice count is
+// doubled until a run fails and then bisected, each run a fresh synth, for every render thread count
+// and SIMD tier asked for.
+//
+//     cpp-synth-loadtest [--rate hz] [--block frames] [--budget fraction] [--blocks n]
+//                        [--threads 1,2,4] [--tiers scalar,avx2] [--max voices] [--seed n]
+//                        [--realtime] [--json out.json]
+//
+// Blocks are rendered back to back unless --realtime paces them like a sound card, which also
+// lets idle render workers park between blocks as they would live. --rate only sets the deadline,
+// the engine always renders at SAMPLE_RATE.
+//
+// --blocks is at least 10000. Over fewer blocks p99.9 is no better than the worst block or two, and
+// one scheduler hiccup would decide the voice count on its own.
+
+// fewest blocks a p99.9 verdict is taken over, so ten blocks lie above the percentile
+constexpr std::size_t MIN_BLOCKS = 10000;
+
+struct LoadConfig
+{
+    double        rate     = SAMPLE_RATE;
+    unsigned long block    = 256;
+    double        budget   = 0.7;
+    std::size_t   blocks   = MIN_BLOCKS;
+    int           max      = 4096;
+    unsigned      seed     = 1;
+    bool          realtime = false;
+};
+
+// a run that could not open the synth has infinite load, so it fails any budget
+struct LoadRun
+{
+    double p50  = 0;
+    double p999 = 0;
+    double max  = 0;
+};
+
+struct Capacity
+{
+    std::size_t threads = 1;
+    SimdTier    tier    = SimdTier::scalar;
+    int         voices  = 0;
+    // every run passed, the machine can take more than the test went to
+    bool        at_max  = false;
+};
+
+// one run at a fixed voice count, the loads are shares of the buffer period at the configured rate
+static LoadRun run_voices(const LoadConfig& cfg, std::size_t threads, SimdTier tier, int voices, WavetableCache& tables) {
+    Synth st;
+    NullBackend backend(cfg.block, cfg.realtime);
+    st.set_render_threads(threads);
+    if (!st.open(&backend, (std::size_t)voices))
+        return { INFINITY, INFINITY, INFINITY };
+    st.voices.dsp = kernels_for(tier);
+
+    // the same random oscillators and notes for every run of a test, so counts compare
+    std::mt19937 rng(cfg.seed);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    for (int o = 0; o < OSC_COUNT; o++) {
+        st.publish_table(o, tables.get_bank((int)(rng() % 4), 0.1f + 0.8f * unit(rng)));
+        st.set_param(o, Param::attack, 200.0f * unit(rng));
+        st.set_param(o, Param::decay, 500.0f * unit(rng));
+        // some level left, the voices have to keep sounding
+        st.set_param(o, Param::sustain, 0.2f + 0.8f * unit(rng));
+        st.set_param(o, Param::release, 50.0f + 500.0f * unit(rng));
+    }
+    // the command queue is short, so the notes are fed through a few blocks before the timing starts
+    static float scratch[2 * MAX_BLOCK_SIZE];
+    for (int v = 0; v < voices; v++)
+        while (!st.note_on(24 + (int)(rng() % 72)))
+            st.render(scratch, cfg.block);
+    st.render(scratch, cfg.block);
+
+    const auto timed = [&] { return backend.callback_timing().histogram().count(); };
+    const auto wait_for = [&](std::uint64_t count) {
+        while (timed() < count)
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    };
+    st.start();
+    wait_for(std::min<std::size_t>(cfg.blocks / 10 + 1, 50));
+    backend.reset_timing();
+    wait_for(cfg.blocks);
+    st.stop();
+
+    const LoadHistogram& histogram = backend.callback_timing().histogram();
+    const double period_ticks = 1e9 * cfg.block / cfg.rate / ns_per_tick();
+    LoadRun run;
+    run.p50 = histogram.percentile(0.5) / period_ticks;
+    run.p999 = histogram.percentile(0.999) / period_ticks;
+    run.max = histogram.max() / period_ticks;
+    st.close();
+    return run;
+}
+
+static Capacity find_capacity(const LoadConfig& cfg, std::size_t threads, SimdTier tier, WavetableCache& tables) {
+    printf("%zu threads, %s kernels\n", threads, SIMD_TIER_NAMES[(int)tier]);
+    const auto passes = [&](int voices) {
+        const LoadRun run = run_voices(cfg, threads, tier, voices, tables);
+        const bool ok = run.p999 <= cfg.budget;
+        if (std::isinf(run.p999))
+            printf("  %5d voices: could not open the synth  over\n", voices);
+        else
+            printf("  %5d voices: p50 %5.1f%%  p99.9 %5.1f%%  max %5.1f%%  %s\n", voices, 100.0 * run.p50, 100.0 * run.p999,
+                100.0 * run.max, ok ? "ok" : "over");
+        fflush(stdout);
+        return ok;
+    };
+    Capacity c{ threads, tier };
+    int good = 0, bad = 0;
+    for (int voices = 8; voices <= cfg.max && bad == 0; voices = std::min(voices * 2, voices == cfg.max ? cfg.max + 1 : cfg.max)) {
+        if (passes(voices))
+            good = voices;
+        else
+            bad = voices;
+    }
+    if (bad == 0) {
+        c.voices = good;
+        c.at_max = true;
+        return c;
+    }
+    // to within a few percent
+    while (bad - good > std::max(1, good / 32)) {
+        const int mid = (good + bad) / 2;
+        if (passes(mid))
+            good = mid;
+        else
+            bad = mid;
+    }
+    c.voices = good;
+    return c;
+}
+
+static std::vector<std::string> split(const char* list) {
+    std::vector<std::string> items;
+    std::string item;
+    for (const char* p = list; ; p++) {
+        if (*p == ',' || *p == 0) {
+            if (!item.empty())
+                items.push_back(item);
+            item.clear();
+            if (*p == 0)
+                break;
+        }
+        else
+            item += *p;
+    }
+    return items;
+}
+
+static bool write_json(const char* path, const LoadConfig& cfg, const std::vector<Capacity>& found) {
+    FILE* f = fopen(path, "w");
+    if (f == nullptr)
+        return false;
+    fprintf(f, "{\n  \"rate\": %.0f,\n  \"block\": %lu,\n  \"budget\": %.3f,\n  \"blocks\": %zu,\n  \"cpus\": %u,\n  \"realtime\": %s,\n  \"results\": [",
+        cfg.rate, cfg.block, cfg.budget, cfg.blocks, std::thread::hardware_concurrency(), cfg.realtime ? "true" : "false");
+    for (std::size_t i = 0; i < found.size(); i++)
+        fprintf(f, "%s\n    { \"threads\": %zu, \"simd\": \"%s\", \"voices\": %d, \"at_max\": %s }", i ? "," : "",
+            found[i].threads, SIMD_TIER_NAMES[(int)found[i].tier], found[i].voices, found[i].at_max ? "true" : "false");
+    fprintf(f, "\n  ]\n}\n");
+    return fclose(f) == 0;
+}
+
+int main(int argc, char** argv) {
+    LoadConfig cfg;
+    const char* json_path = nullptr;
+    std::vector<std::size_t> thread_counts;
+    std::vector<SimdTier> tiers;
+    bool usage = false;
+    for (int a = 1; a < argc && !usage; a++) {
+        const bool more = a + 1 < argc;
+        if (!strcmp(argv[a], "--rate") && more)
+            cfg.rate = strtod(argv[++a], nullptr);
+        else if (!strcmp(argv[a], "--block") && more)
+            cfg.block = strtoul(argv[++a], nullptr, 10);
+        else if (!strcmp(argv[a], "--budget") && more)
+            cfg.budget = strtod(argv[++a], nullptr);
+        else if (!strcmp(argv[a], "--blocks") && more)
+            cfg.blocks = strtoul(argv[++a], nullptr, 10);
+        else if (!strcmp(argv[a], "--max") && more)
+            cfg.max = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--seed") && more)
+            cfg.seed = (unsigned)strtoul(argv[++a], nullptr, 10);
+        else if (!strcmp(argv[a], "--realtime"))
+            cfg.realtime = true;
+        else if (!strcmp(argv[a], "--json") && more)
+            json_path = argv[++a];
+        else if (!strcmp(argv[a], "--threads") && more) {
+            for (const std::string& t : split(argv[++a]))
+                thread_counts.push_back(std::max<std::size_t>(strtoul(t.c_str(), nullptr, 10), 1));
+        }
+        else if (!strcmp(argv[a], "--tiers") && more) {
+            for (const std::string& name : split(argv[++a])) {
+                const auto* end = std::end(SIMD_TIER_NAMES);
+                const auto* it = std::find_if(std::begin(SIMD_TIER_NAMES), end, [&](const char* n) { return name == n; });
+                if (it == end || (int)(it - std::begin(SIMD_TIER_NAMES)) > (int)runtime_simd_tier()) {
+                    fprintf(stderr, "%s kernels are not available here\n", name.c_str());
+                    return 1;
+                }
+                tiers.push_back((SimdTier)(it - std::begin(SIMD_TIER_NAMES)));
+            }
+        }
+        else
+            usage = true;
+    }
+    if (!usage && cfg.blocks < MIN_BLOCKS) {
+        fprintf(stderr, "--blocks %zu is too few for a p99.9, it takes at least %zu\n", cfg.blocks, MIN_BLOCKS);
+        return 1;
+    }
+    if (usage || cfg.block == 0 || cfg.block > MAX_BLOCK_SIZE || cfg.rate <= 0 || cfg.budget <= 0 || cfg.max < 8) {
+        fprintf(stderr, "usage: %s [--rate hz] [--block frames] [--budget fraction] [--blocks n] [--threads 1,2,4]"
+                        " [--tiers scalar,avx2] [--max voices] [--seed n] [--realtime] [--json out.json]\n", argv[0]);
+        return 1;
+    }
+    const unsigned cpus = std::max(std::thread::hardware_concurrency(), 1u);
+    // every power of two up to the core count, and the core count itself
+    if (thread_counts.empty()) {
+        for (std::size_t t = 1; t < cpus; t *= 2)
+            thread_counts.push_back(t);
+        thread_counts.push_back(cpus);
+    }
+    if (tiers.empty())
+        for (int t = 0; t <= (int)runtime_simd_tier(); t++)
+            tiers.push_back((SimdTier)t);
+
+    printf("%u cpus, %lu frame blocks, deadline %.0f us at %.0f Hz, budget %.0f%% at p99.9 over %zu blocks%s\n",
+        cpus, cfg.block, 1e6 * cfg.block / cfg.rate, cfg.rate, 100.0 * cfg.budget, cfg.blocks, cfg.realtime ? ", paced" : "");
+    if (cfg.rate != SAMPLE_RATE)
+        printf("the engine renders at %d Hz, --rate only moves the deadline\n", SAMPLE_RATE);
+
+    WavetableCache tables;
+    std::vector<Capacity> found;
+    for (std::size_t threads : thread_counts)
+        for (SimdTier tier : tiers)
+            found.push_back(find_capacity(cfg, threads, tier, tables));
+
+    printf("max polyphony\n%-8s", "threads");
+    for (SimdTier tier : tiers)
+        printf(" %8s", SIMD_TIER_NAMES[(int)tier]);
+    printf("\n");
+    for (std::size_t t = 0; t < thread_counts.size(); t++) {
+        printf("%-8zu", thread_counts[t]);
+        for (std::size_t k = 0; k < tiers.size(); k++) {
+            const Capacity& c = found[t * tiers.size() + k];
+            printf(" %7d%s", c.voices, c.at_max ? "+" : " ");
+        }
+        printf("\n");
+    }
+    if (json_path && !write_json(json_path, cfg, found)) {
+        fprintf(stderr, "Could not write %s\n", json_path);
+        return 1;
+    }
+    return 0;
+}
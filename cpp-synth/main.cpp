@@ -11,18 +11,85 @@
 #include <string>
 #include <utility>
 #include <thread>
+#include <memory>
+#include <array>
+#include <optional>
+#include <cstring>
+#include <chrono>
 #include "wavetable.h"
 #include "imgui_includes.h"
 #include "Synth.h"
+#include "PerfCounters.h"
+#include "Trace.h"
+#include "PortAudioBackend.h"
+#include "WavetableCache.h"
 #include <map>
 
 void glfw_error_callback(int error, const char* description){
     fprintf(stderr, "GLFW Error %d: %s\n", error, description);
 }
 
-int main(int, char**) {
+static void print_load(const LoadStats& load) {
+    printf("callbacks %llu of %.0f us: load p50 %.1f%% p99 %.1f%% p99.9 %.1f%% max %.1f%%, %llu late, %llu underflows, %llu overflows\n",
+        (unsigned long long)load.callbacks, load.period_us, 100.0 * load.p50, 100.0 * load.p99, 100.0 * load.p999, 100.0 * load.max,
+        (unsigned long long)load.late, (unsigned long long)load.underflows, (unsigned long long)load.overflows);
+}
+
+int main(int argc, char** argv) {
     int display_w, display_h;
 
+    // audio output: the default device, or --null / --out <file|-> for machines without one
+    const char* out_path = nullptr;
+    bool null_output = false;
+    unsigned long block_size = 512;
+    // voice rendering threads including the audio thread, workers spin instead of parking with --spin
+    std::size_t render_threads = 1;
+    bool spin_workers = false, pin_workers = false;
+    // level changes glide over this long, in a straight line or with --one-pole exponentially
+    float smoothing_ms = DEFAULT_SMOOTHING_MS;
+    Smoothing smoothing = Smoothing::linear;
+    // callback load percentiles printed every second
+    bool print_timing = false;
+    // trace zones recorded from the start and written here at exit, the GUI can save one at any time too
+    const char* trace_path = nullptr;
+    // hardware counters per render stage, reported at exit
+    bool count_perf = false;
+    for (int a = 1; a < argc; a++)
+    {
+        if (!strcmp(argv[a], "--null"))
+            null_output = true;
+        else if (!strcmp(argv[a], "--out") && a + 1 < argc)
+            out_path = argv[++a];
+        else if (!strcmp(argv[a], "--block") && a + 1 < argc)
+            block_size = strtoul(argv[++a], nullptr, 10);
+        else if (!strcmp(argv[a], "--threads") && a + 1 < argc)
+            render_threads = strtoul(argv[++a], nullptr, 10);
+        else if (!strcmp(argv[a], "--spin"))
+            spin_workers = true;
+        else if (!strcmp(argv[a], "--pin"))
+            pin_workers = true;
+        else if (!strcmp(argv[a], "--smooth") && a + 1 < argc)
+            smoothing_ms = strtof(argv[++a], nullptr);
+        else if (!strcmp(argv[a], "--one-pole"))
+            smoothing = Smoothing::one_pole;
+        else if (!strcmp(argv[a], "--timing"))
+            print_timing = true;
+        else if (!strcmp(argv[a], "--trace") && a + 1 < argc)
+            trace_path = argv[++a];
+        else if (!strcmp(argv[a], "--perf"))
+            count_perf = true;
+        else
+        {
+            fprintf(stderr, "usage: %s [--null | --out <file.wav|file.raw|->] [--block frames] [--threads n [--spin] [--pin]] [--smooth ms [--one-pole]] [--timing] [--trace file.json] [--perf]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    trace_thread("gui");
+    if (trace_path)
+        trace_enable(true);
+    perf_enable(count_perf);
+
     // start setting up glfw
     glfwSetErrorCallback(glfw_error_callback);
     if (!glfwInit())
@@ -40,25 +107,37 @@ int main(int, char**) {
     glfwMakeContextCurrent(window);
     glfwSwapInterval(1);
 
-    Synth st;
-    ScopedPaHandler paInit;
-    
-    // Check that port audio streams are opened correctly with no errors
-    if (paInit.result()) 
+    std::optional<ScopedPaHandler> paInit;
+    std::unique_ptr<AudioBackend> backend;
+    if (null_output)
+        backend = std::make_unique<NullBackend>(block_size);
+    else if (out_path)
+        backend = std::make_unique<FileBackend>(out_path, block_size, true);
+    else
     {
-        fprintf(stderr, "An error occurred while using the portaudio stream\n");
-        fprintf(stderr, "Error number: %d\n", paInit.result());
-        fprintf(stderr, "Error message: %s\n", Pa_GetErrorText(paInit.result()));
-        return 1;
+        paInit.emplace();
+        // Check that port audio streams are opened correctly with no errors
+        if (paInit->result()) 
+        {
+            fprintf(stderr, "An error occurred while using the portaudio stream\n");
+            fprintf(stderr, "Error number: %d\n", paInit->result());
+            fprintf(stderr, "Error message: %s\n", Pa_GetErrorText(paInit->result()));
+            return 1;
+        }
+        backend = std::make_unique<PortAudioBackend>(Pa_GetDefaultOutputDevice(), block_size);
     }
-    if (!st.open(Pa_GetDefaultOutputDevice())) 
+
+    Synth st;
+    st.set_render_threads(render_threads, spin_workers, pin_workers);
+    st.set_smoothing(smoothing, smoothing_ms);
+    if (!st.open(backend.get())) 
     {
-        fprintf(stderr, "An error occurred while using the portaudio stream\n");
+        fprintf(stderr, "An error occurred while opening the audio output\n");
         return 1;
     }
     if (!st.start()) 
     {
-        fprintf(stderr, "An error occurred while using the portaudio stream\n");
+        fprintf(stderr, "An error occurred while starting the audio output\n");
         return 1;
     }
 
@@ -101,9 +180,6 @@ int main(int, char**) {
     if (no_bring_to_front)  window_flags |= ImGuiWindowFlags_NoBringToFrontOnFocus;
     if (unsaved_document)   window_flags |= ImGuiWindowFlags_UnsavedDocument;
 
-    // wwaveform names for dropdown lists
-    const char* waveforms[] = { "Sawtooth", "Sine", "Square", "Triangle", "Silence"};
-
     // notes for dropdown list, index used for freq manipulation
     const char* notes[] = { "A0", "A#0", "B0",
         "C1", "C#1", "D1", "D#1", "E1", "F1", "F#1", "G1", "G#1", "A1", "A#1", "B1",
@@ -130,21 +206,40 @@ int main(int, char**) {
         ImGuiKey_Comma
     };
 
-    // Create a map of keys to musical notes at the base octave
-    std::map<ImGuiKey, float> key_freqs;
+    // Create a map of keys to midi notes at the base octave, and of held keys to the note they started
+    std::map<ImGuiKey, int> key_notes;
+    std::map<ImGuiKey, int> held_notes;
     int i = 0;
     for (const auto& key : keys )
     {
-        key_freqs[key] = std::pow(2, (float)((i + 3) / 12.0));
+        key_notes[key] = 36 + i;
         i++;
     }
 
     // Multiplier for octave
     int base = 1;
 
+    // GUI side copies of the oscillator settings, the audio thread owns the real ones
+    WavetableCache tables;
+    std::array<Oscillator, OSC_COUNT> ui_oscs;
+    for (int o = 0; o < OSC_COUNT; o++)
+    {
+        ui_oscs[o] = *st.oscs[o];
+        st.publish_table(o, tables.get_bank(ui_oscs[o].current_waveform, ui_oscs[o].pulse_width));
+    }
+    // GUI side patch, compiled into a new plan on every edit
+    Patch patch = default_patch();
+    std::string patch_error;
+    // histogram of the callback times as the plot wants it
+    std::array<float, HISTOGRAM_BUCKETS> callback_buckets{};
+    auto last_timing = std::chrono::steady_clock::now();
+    bool tracing = trace_enabled();
+    std::string trace_status;
+
     SetupImGuiStyle();
     while (!glfwWindowShouldClose(window))
     {
+        TraceZone frame_zone("frame");
         // get ready for drawing GUI
         glfwPollEvents();
         ImGui_ImplOpenGL3_NewFrame();
@@ -153,82 +248,78 @@ int main(int, char**) {
 
         ImGui::ShowDemoWindow();
 
-        bool gui_updated = true;
         bool imgui_visible = true;
 
-        size_t osc_idx = 0;
-        for (auto& osc : st.oscs) 
+        // widgets edit the GUI copies, changes are sent to the audio thread as commands
+        int osc_idx = 0;
+        for (auto& ui_osc : ui_oscs) 
         {
+            Oscillator* osc = &ui_osc;
             ImGui::PushID(osc_idx);
             ImGui::Begin((std::string("Oscillator ") + std::string(1, osc->label)).c_str(), &imgui_visible, window_flags);
-            ImGui::PlotLines("Waveform", (float*)osc->table, TABLE_SIZE, 0, nullptr, -1.1f, 1.1f, ImVec2(100.0f, 100.0f));
+            ImGui::PlotLines("Waveform", st.table(osc_idx)->level(0).data, TABLE_SIZE, 0, nullptr, -1.1f, 1.1f, ImVec2(100.0f, 100.0f));
             ImGui::SeparatorText("Waveform");
-            if (ImGui::Combo("Waveform", (int*)&osc->current_waveform, waveforms, IM_ARRAYSIZE(waveforms)))
-                gui_updated = true;
+            if (ImGui::Combo("Waveform", (int*)&osc->current_waveform, WAVEFORM_NAMES, IM_ARRAYSIZE(WAVEFORM_NAMES)))
+                st.publish_table(osc_idx, tables.get_bank(osc->current_waveform, osc->pulse_width));
 
             switch (osc->current_waveform) 
             {
-                case 0: // saw not special 
-                    gen_saw_wave(osc);
-                    break;
-                case 1: // sin not special
-                    gen_sin_wave(osc);
-                    break;
                 case 2: // square has a pulse width
-                    gen_sqr_wave(osc);
                     if (ImGui::CollapsingHeader("Square Settings", ImGuiTreeNodeFlags_DefaultOpen))
                         if (ImGui::DragFloat("Pulse Width", &osc->pulse_width, 0.0025f, 0.0f, 1.0f))
-                            gui_updated = true;
+                            st.publish_table(osc_idx, tables.get_bank(osc->current_waveform, osc->pulse_width));
                     break;
                 case 3:
-                    gen_tri_wave(osc, osc->pulse_width);
                     if (ImGui::CollapsingHeader("Triangle Settings", ImGuiTreeNodeFlags_DefaultOpen))
                         if (ImGui::DragFloat("Duty Cycle", &osc->pulse_width, 0.0025f, 0.0f, 1.0f))
-                            gui_updated = true;
+                            st.publish_table(osc_idx, tables.get_bank(osc->current_waveform, osc->pulse_width));
                     break;
-                case 4:
-                    gen_silence(osc);
             }
 
             // settings such as per channel pitch
             st.amplitude = 0.5;
 
-            for (ImGuiKey key = ImGuiKey_NamedKey_BEGIN; key < ImGuiKey_NamedKey_END; key = (ImGuiKey)(key + 1)) 
-            { 
-                if (ImGui::IsKeyDown(key) && std::find(keys.begin(), keys.end(), key) != keys.end())
-                {
-                    osc->env.key_on(get_time());
-                    // ImGui::Text((key < ImGuiKey_NamedKey_BEGIN) ? "\"%s\"" : "\"%s\" %d", ImGui::GetKeyName(key), key); 
-                    osc->left_phase_inc = base * key_freqs[key];
-                    osc->right_phase_inc = base * key_freqs[key];
-                    osc->env.lock = true;
-                }
-                if (ImGui::IsKeyReleased(key))
+            ImGui::SeparatorText("BASE");
+            ImGui::Text("Base %d", base);
+            ImGui::Text("Time %llu", (unsigned long long)st.now());
+            ImGui::Text("Voices %zu/%zu (%s kernels, %zu threads)", st.active_voices.load(), st.voices.capacity(),
+                SIMD_TIER_NAMES[(int)st.voices.dsp.tier], st.render_threads());
+            ImGui::Text("Tables %zu (%zu KB) hits %llu misses %llu", tables.size(), tables.bytes() / 1024,
+                        (unsigned long long)tables.hits(), (unsigned long long)tables.misses());
+            const MemoryStats mem = st.memory();
+            ImGui::Text("Memory %zu KB, peak voices %zu/%zu events %zu/%zu scratch %zu/%zu KB, %zu misses",
+                        mem.arena_bytes / 1024, mem.voices_peak, mem.voice_slots, mem.events_peak, mem.events,
+                        mem.scratch_peak / 1024, mem.scratch_bytes / 1024, mem.misses);
+            if (ImGui::TreeNode("Render graph"))
+            {
+                // the mixdown, then the patch steps by kind, then the voice chunks
+                const std::size_t nodes = st.graph_nodes.load();
+                for (std::size_t n = 0; n < nodes; n++)
                 {
-                    osc->env.keyoff_amp = osc->env.get_amp(get_time());
-                    osc->env.key_off(get_time());
-                    osc->env.lock = false;
+                    const TaskNode& node = st.graph_node(n);
+                    ImGui::Text("%s %zu: %.1f us (max %.1f us)", node.name, n,
+                                node.last_ns.load() / 1000.0, node.max_ns.load() / 1000.0);
                 }
-                
+                ImGui::TreePop();
             }
-            ImGui::SeparatorText("BASE");
-            ImGui::Text("Base %d", base);
-            ImGui::Text("Time %d", get_time());
-            ImGui::Text("Note on %d", osc->env.note_on);
-            ImGui::Text("Amp %f", osc->env.get_amp(get_time()));
 
             if (ImGui::BeginTable("ADSR Envelope", 5))
             {
                 ImGui::TableNextColumn();
-                ImGui::VSliderFloat("##A", {50.0f, 150.0f}, &osc->env.attack_time, 0.0f, 2500.0f);
+                if (ImGui::VSliderFloat("##A", {50.0f, 150.0f}, &osc->env.attack_time, 0.0f, 2500.0f))
+                    st.set_param(osc_idx, Param::attack, osc->env.attack_time);
                 ImGui::TableNextColumn();
-                ImGui::VSliderFloat("##D", {50.0f, 150.0f}, &osc->env.decay_time, 0.0f, 2500.0f);
+                if (ImGui::VSliderFloat("##D", {50.0f, 150.0f}, &osc->env.decay_time, 0.0f, 2500.0f))
+                    st.set_param(osc_idx, Param::decay, osc->env.decay_time);
                 ImGui::TableNextColumn();
-                ImGui::VSliderFloat("##S", {50.0f, 150.0f}, &osc->env.sustain_amp, 0.0f, 1.0f);
+                if (ImGui::VSliderFloat("##S", {50.0f, 150.0f}, &osc->env.sustain_amp, 0.0f, 1.0f))
+                    st.set_param(osc_idx, Param::sustain, osc->env.sustain_amp);
                 ImGui::TableNextColumn();
-                ImGui::VSliderFloat("##R", {50.0f, 150.0f}, &osc->env.release_time, 0.01f, 2500.0f);
+                if (ImGui::VSliderFloat("##R", {50.0f, 150.0f}, &osc->env.release_time, 0.01f, 2500.0f))
+                    st.set_param(osc_idx, Param::release, osc->env.release_time);
                 ImGui::TableNextColumn();
-                ImGui::VSliderFloat("##Z", {50.0f, 150.0f}, &osc->amp, 0.0f, 1.0f);
+                if (ImGui::VSliderFloat("##Z", {50.0f, 150.0f}, &osc->amp, 0.0f, 1.0f))
+                    st.set_param(osc_idx, Param::osc_amp, osc->amp);
                 ImGui::EndTable();
             }
 
@@ -237,6 +328,186 @@ int main(int, char**) {
             ImGui::PopID();
         }
 
+        // the patch is edited here and recompiled on this thread, the audio thread picks the plan up at its next block
+        ImGui::Begin("Patch", &imgui_visible, window_flags);
+        {
+            bool edited = false;
+            int remove_id = -1;
+            for (auto& node : patch.nodes)
+            {
+                ImGui::PushID(node.id);
+                ImGui::SeparatorText((std::to_string(node.id) + " " + NODE_KIND_NAMES[(int)node.kind]).c_str());
+                switch (node.kind)
+                {
+                    case NodeKind::oscillator:
+                    {
+                        int o = (int)node.params[0];
+                        if (ImGui::Combo("Oscillator", &o, "A\0B\0C\0"))
+                        {
+                            node.params[0] = (float)o;
+                            edited = true;
+                        }
+                        break;
+                    }
+                    case NodeKind::envelope:
+                        edited |= ImGui::DragFloat("Attack", &node.params[0], 1.0f, 0.0f, 2500.0f);
+                        edited |= ImGui::DragFloat("Decay", &node.params[1], 1.0f, 0.0f, 2500.0f);
+                        edited |= ImGui::DragFloat("Sustain", &node.params[2], 0.005f, 0.0f, 1.0f);
+                        edited |= ImGui::DragFloat("Release", &node.params[3], 1.0f, 0.01f, 2500.0f);
+                        break;
+                    case NodeKind::filter:
+                    {
+                        int mode = (int)node.params[0];
+                        if (ImGui::Combo("Mode", &mode, FILTER_MODE_NAMES, IM_ARRAYSIZE(FILTER_MODE_NAMES)))
+                        {
+                            node.params[0] = (float)mode;
+                            edited = true;
+                        }
+                        edited |= ImGui::DragFloat("Cutoff", &node.params[1], 5.0f, 20.0f, 20000.0f);
+                        edited |= ImGui::DragFloat("Resonance", &node.params[2], 0.01f, 0.1f, 20.0f);
+                        break;
+                    }
+                    case NodeKind::mixer:
+                        for (int k = 0; k < NODE_INPUTS; k++)
+                            edited |= ImGui::DragFloat(("Gain " + std::to_string(k)).c_str(), &node.params[k], 0.005f, 0.0f, 2.0f);
+                        break;
+                    case NodeKind::effect:
+                        edited |= ImGui::DragFloat("Time", &node.params[0], 1.0f, 1.0f, MAX_DELAY_MS);
+                        edited |= ImGui::DragFloat("Feedback", &node.params[1], 0.005f, 0.0f, 0.95f);
+                        edited |= ImGui::DragFloat("Wet", &node.params[2], 0.005f, 0.0f, 1.0f);
+                        break;
+                }
+                // inputs by node id, -1 leaves one unconnected
+                const int inputs = node.kind == NodeKind::oscillator ? 0 : (node.kind == NodeKind::mixer ? NODE_INPUTS : 1);
+                for (int k = 0; k < inputs; k++)
+                    edited |= ImGui::InputInt(("Input " + std::to_string(k)).c_str(), &node.inputs[k]);
+                if (ImGui::Button("Output"))
+                {
+                    patch.output = node.id;
+                    edited = true;
+                }
+                ImGui::SameLine();
+                if (ImGui::Button("Remove"))
+                    remove_id = node.id;
+                ImGui::PopID();
+            }
+            if (remove_id >= 0)
+            {
+                patch.remove(remove_id);
+                edited = true;
+            }
+            ImGui::SeparatorText("Add");
+            for (int k = 0; k < IM_ARRAYSIZE(NODE_KIND_NAMES); k++)
+            {
+                if (k > 0)
+                    ImGui::SameLine();
+                if (ImGui::Button(NODE_KIND_NAMES[k]))
+                    patch.add((NodeKind)k);
+            }
+            if (edited)
+                patch_error.clear();
+            if (edited && !st.publish_patch(patch, &patch_error))
+                patch_error = "not playing: " + patch_error;
+            ImGui::Text("Output %d, %zu steps in %d buffers", patch.output, st.patch_plan().size(), st.patch_plan().buffers_used());
+            if (!patch_error.empty())
+                ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "%s", patch_error.c_str());
+        }
+        ImGui::End();
+
+        // how close the audio callback runs to its deadline
+        ImGui::Begin("Audio callback", &imgui_visible, window_flags);
+        {
+            const CallbackTiming& timing = backend->callback_timing();
+            const LoadStats load = timing.stats();
+            ImGui::Text("%llu callbacks of %.0f us", (unsigned long long)load.callbacks, load.period_us);
+            ImGui::Text("Load p50 %.1f%%  p99 %.1f%%  p99.9 %.1f%%  max %.1f%%",
+                        100.0 * load.p50, 100.0 * load.p99, 100.0 * load.p999, 100.0 * load.max);
+            ImGui::Text("Late %llu  underflows %llu  overflows %llu", (unsigned long long)load.late,
+                        (unsigned long long)load.underflows, (unsigned long long)load.overflows);
+            // the buckets from the first to the last one used, log2 spaced with 8 steps an octave
+            const LoadHistogram& histogram = timing.histogram();
+            int first = HISTOGRAM_BUCKETS, last = 0;
+            for (int b = 0; b < HISTOGRAM_BUCKETS; b++)
+            {
+                callback_buckets[b] = (float)histogram.bucket(b);
+                if (callback_buckets[b] > 0)
+                {
+                    first = std::min(first, b);
+                    last = b;
+                }
+            }
+            if (first <= last)
+                ImGui::PlotHistogram("Callback time", &callback_buckets[first], last - first + 1, 0, nullptr, 0.0f, FLT_MAX, ImVec2(0.0f, 80.0f));
+            if (ImGui::Button("Reset"))
+                backend->reset_timing();
+            // audio, worker and GUI zones on one timeline, for chrome://tracing or ui.perfetto.dev
+            if (ImGui::Checkbox("Record trace", &tracing))
+                trace_enable(tracing);
+            ImGui::SameLine();
+            if (ImGui::Button("Save trace"))
+                trace_status = trace_dump("cpp-synth-trace.json") ? "saved cpp-synth-trace.json" : "could not write cpp-synth-trace.json";
+            if (!trace_status.empty())
+                ImGui::Text("%s", trace_status.c_str());
+
+            // per block hardware counts of each stage, to watch miss rates as voices and tables grow
+            if (ImGui::Checkbox("Count hardware events", &count_perf))
+                perf_enable(count_perf);
+            ImGui::SameLine();
+            if (ImGui::Button("Reset counts"))
+                perf_reset();
+            // render threads register on their first block, their counters are opened from here
+            if (count_perf)
+                perf_open_threads();
+            const PerfStats perf = perf_stats();
+            if (count_perf && !perf.available && perf.error)
+                ImGui::Text("Counters unavailable: %s", strerror(perf.error));
+            else if (perf.available && ImGui::BeginTable("Counters", 6))
+            {
+                const char* columns[] = { "Stage", "Cycles", "IPC", "L1D/kinst", "LLC/kinst", "Branch/kinst" };
+                for (const char* column : columns)
+                    ImGui::TableSetupColumn(column);
+                ImGui::TableHeadersRow();
+                const double blocks = (double)std::max<std::uint64_t>(perf.blocks, 1);
+                // without rdpmc only the render threads' total is known
+                for (int s = perf.staged ? 0 : PERF_STAGES; s <= PERF_STAGES; s++)
+                {
+                    const std::uint64_t* c = s < PERF_STAGES ? perf.counts[s] : perf.total;
+                    const double kinst = std::max(c[(int)PerfEvent::instructions] / 1000.0, 1e-9);
+                    ImGui::TableNextColumn(); ImGui::TextUnformatted(s < PERF_STAGES ? PERF_STAGE_NAMES[s] : "block");
+                    ImGui::TableNextColumn(); ImGui::Text("%.0f", c[(int)PerfEvent::cycles] / blocks);
+                    ImGui::TableNextColumn(); ImGui::Text("%.2f", (double)c[(int)PerfEvent::instructions] / std::max<std::uint64_t>(c[(int)PerfEvent::cycles], 1));
+                    ImGui::TableNextColumn(); ImGui::Text("%.2f", c[(int)PerfEvent::l1d_misses] / kinst);
+                    ImGui::TableNextColumn(); ImGui::Text("%.3f", c[(int)PerfEvent::llc_misses] / kinst);
+                    ImGui::TableNextColumn(); ImGui::Text("%.2f", c[(int)PerfEvent::branch_misses] / kinst);
+                }
+                ImGui::EndTable();
+            }
+        }
+        ImGui::End();
+        if (print_timing && std::chrono::steady_clock::now() - last_timing >= std::chrono::seconds(1))
+        {
+            last_timing = std::chrono::steady_clock::now();
+            print_load(backend->callback_timing().stats());
+        }
+
+        // free tables and plans the audio thread has moved past
+        st.collect_retired();
+
+        // each key press starts its own voice. A released key stays held until its note off fits in
+        // the command queue, and is tried again every frame so the note cannot stick
+        for (const auto& key : keys)
+        {
+            const auto held = held_notes.find(key);
+            if (held != held_notes.end() && !ImGui::IsKeyDown(key) && st.note_off(held->second))
+                held_notes.erase(held);
+            if (ImGui::IsKeyPressed(key, false) && !held_notes.count(key))
+            {
+                const int note = key_notes[key] + 12 * (int)std::log2(base);
+                if (st.note_on(note))
+                    held_notes[key] = note;
+            }
+        }
+
         if (ImGui::IsKeyPressed(ImGuiKey_LeftShift, false))
             base = (base > 1) ? base / 2 : base; 
         if (ImGui::IsKeyPressed(ImGuiKey_RightShift))
@@ -246,6 +517,7 @@ int main(int, char**) {
         ImGui::Render();
 
         // set the window up for drawing
+        TraceZone draw_zone("draw");
         glfwGetFramebufferSize(window, &display_w, &display_h);
         glViewport(0, 0, display_w, display_h);
         glClearColor(clear_color.x * clear_color.w, clear_color.y * clear_color.w, clear_color.z * clear_color.w, clear_color.w);
@@ -256,6 +528,13 @@ int main(int, char**) {
         glfwSwapBuffers(window);
     }
 
+    st.stop();
+    if (print_timing)
+        print_load(backend->callback_timing().stats());
+    if (trace_path && !trace_dump(trace_path))
+        fprintf(stderr, "Could not write the trace to %s\n", trace_path);
+    if (count_perf)
+        perf_report(stdout, perf_stats());
     st.close();
 
     ImGui_ImplOpenGL3_Shutdown();
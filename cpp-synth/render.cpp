@@ -0,0 +1,298 @@
+#include <stdio.h>
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "Patch.h"
+#include "PerfCounters.h"
+#include "RtCheck.h"
+#include "Synth.h"
+#include "wavetable.h"
+#include "WavetableCache.h"
+#include "wavfile.h"
+
+// Headless bounce of a patch and a note script to a WAV file, as fast as the CPU allows.
+//
+// patch file, one setting per line:
+//     amplitude 0.5
+//     interpolation cubic          (none, linear, cubic or sinc)
+//     smoothing one_pole 30        (linear or one_pole, ramp ms for level changes)
+//     A waveform Square
+//     A pulse_width 0.25
+//     A adsr 10 200 0.6 300        (attack ms, decay ms, sustain level, release ms)
+// and optionally a signal graph in place of the three oscillators summed, inputs follow the '<':
+//     node 0 oscillator A
+//     node 1 oscillator B
+//     node 2 filter lowpass 800 2  < 0    (mode, cutoff Hz, resonance)
+//     node 3 mixer 1 0.5           < 2 1  (a gain per input)
+//     node 4 envelope 5 100 0.8 400 < 3   (attack ms, decay ms, sustain, release ms)
+//     node 5 delay 300 0.4 0.3     < 4    (time ms, feedback, wet)
+//     output 5
+// note script, one note per line:
+//     0    500  60                 (start ms, length ms, midi note)
+// --perf after the output counts cycles, instructions and misses per render stage (Linux)
+
+struct NoteEvent
+{
+    std::uint64_t sample;
+    bool          on;
+    int           note;
+};
+
+static bool same_name(const char* a, const std::string& b) {
+    return std::equal(b.begin(), b.end(), a, a + strlen(a),
+        [](char x, char y) { return std::tolower((unsigned char)x) == std::tolower((unsigned char)y); });
+}
+
+static Oscillator* find_osc(Synth& st, const std::string& label) {
+    for (auto* osc : st.oscs)
+        if (label.size() == 1 && osc->label == label[0])
+            return osc;
+    return nullptr;
+}
+
+static int find_name(const char* const* names, std::size_t count, const std::string& name) {
+    for (std::size_t i = 0; i < count; i++)
+        if (same_name(names[i], name))
+            return (int)i;
+    return -1;
+}
+
+// "<id> <kind> <params...> [< <input ids...>]", oscillators are named by label and filter modes by name
+static bool parse_node(Synth& st, std::istringstream& ls, Patch* patch) {
+    PatchNode node;
+    std::string kind, word;
+    if (!(ls >> node.id >> kind) || patch->find(node.id))
+        return false;
+    const int k = find_name(NODE_KIND_NAMES, std::size(NODE_KIND_NAMES), kind);
+    if (k < 0)
+        return false;
+    node.kind = (NodeKind)k;
+    int params = 0, inputs = 0;
+    bool reading_inputs = false;
+    while (ls >> word) {
+        if (word == "<")
+            reading_inputs = true;
+        else if (reading_inputs) {
+            if (inputs == NODE_INPUTS)
+                return false;
+            node.inputs[inputs++] = std::stoi(word);
+        }
+        else if (params < NODE_PARAMS) {
+            float value;
+            if (node.kind == NodeKind::oscillator && params == 0) {
+                Oscillator* osc = find_osc(st, word);
+                if (!osc)
+                    return false;
+                value = (float)(std::find(st.oscs.begin(), st.oscs.end(), osc) - st.oscs.begin());
+            }
+            else if (node.kind == NodeKind::filter && params == 0) {
+                const int mode = find_name(FILTER_MODE_NAMES, std::size(FILTER_MODE_NAMES), word);
+                if (mode < 0)
+                    return false;
+                value = (float)mode;
+            }
+            else
+                value = std::stof(word);
+            node.params[params++] = value;
+        }
+        else
+            return false;
+    }
+    patch->nodes.push_back(node);
+    return true;
+}
+
+static bool load_patch(Synth& st, const char* path, Patch* patch) {
+    std::ifstream in(path);
+    if (!in) {
+        fprintf(stderr, "Could not open patch %s\n", path);
+        return false;
+    }
+    std::string line;
+    int line_no = 0;
+    while (std::getline(in, line)) {
+        ++line_no;
+        std::istringstream ls(line);
+        std::string first, key;
+        if (!(ls >> first) || first[0] == '#')
+            continue;
+        if (first == "node") {
+            try {
+                if (parse_node(st, ls, patch))
+                    continue;
+            }
+            catch (const std::exception&) {
+            }
+        }
+        else if (first == "output") {
+            if (ls >> patch->output)
+                continue;
+        }
+        else if (first == "amplitude") {
+            float amp;
+            if (ls >> amp) {
+                st.amplitude = amp;
+                continue;
+            }
+        }
+        else if (first == "smoothing") {
+            std::string name;
+            float ms;
+            if (ls >> name >> ms) {
+                const int mode = find_name(SMOOTHING_NAMES, std::size(SMOOTHING_NAMES), name);
+                if (mode >= 0) {
+                    st.set_smoothing((Smoothing)mode, ms);
+                    continue;
+                }
+            }
+        }
+        else if (first == "interpolation") {
+            std::string name;
+            ls >> name;
+            auto it = std::find_if(std::begin(INTERPOLATION_NAMES), std::end(INTERPOLATION_NAMES),
+                [&](const char* n) { return same_name(n, name); });
+            if (it != std::end(INTERPOLATION_NAMES)) {
+                st.voices.interpolation = (Interpolation)(it - std::begin(INTERPOLATION_NAMES));
+                continue;
+            }
+        }
+        else if (Oscillator* osc = find_osc(st, first); osc && (ls >> key)) {
+            if (key == "waveform") {
+                std::string name;
+                ls >> name;
+                auto it = std::find_if(std::begin(WAVEFORM_NAMES), std::end(WAVEFORM_NAMES),
+                    [&](const char* n) { return same_name(n, name); });
+                if (it != std::end(WAVEFORM_NAMES)) {
+                    osc->current_waveform = (int)(it - std::begin(WAVEFORM_NAMES));
+                    continue;
+                }
+            }
+            else if (key == "pulse_width" && (ls >> osc->pulse_width))
+                continue;
+            else if (key == "adsr" && (ls >> osc->env.attack_time >> osc->env.decay_time
+                                          >> osc->env.sustain_amp >> osc->env.release_time))
+                continue;
+        }
+        fprintf(stderr, "%s:%d: could not parse \"%s\"\n", path, line_no, line.c_str());
+        return false;
+    }
+    return true;
+}
+
+static bool load_notes(std::vector<NoteEvent>& events, const char* path) {
+    std::ifstream in(path);
+    if (!in) {
+        fprintf(stderr, "Could not open note script %s\n", path);
+        return false;
+    }
+    std::string line;
+    int line_no = 0;
+    while (std::getline(in, line)) {
+        ++line_no;
+        std::istringstream ls(line);
+        float start, length;
+        int note;
+        if (line.find_first_not_of(" \t\r") == std::string::npos || line[line.find_first_not_of(" \t\r")] == '#')
+            continue;
+        if (!(ls >> start >> length >> note)) {
+            fprintf(stderr, "%s:%d: could not parse \"%s\"\n", path, line_no, line.c_str());
+            return false;
+        }
+        events.push_back({ ms_to_samples(start), true, note });
+        events.push_back({ ms_to_samples(start + length), false, note });
+    }
+    std::stable_sort(events.begin(), events.end(),
+        [](const NoteEvent& a, const NoteEvent& b) { return a.sample < b.sample; });
+    return true;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 4 || (argc > 4 && strcmp(argv[4], "--perf") != 0)) {
+        fprintf(stderr, "usage: %s <patch> <notes> <out.wav> [--perf]\n", argv[0]);
+        return 1;
+    }
+    // this thread renders, registered first so the counters open with counting turned on
+    perf_register_thread();
+    perf_enable(argc > 4);
+
+    Synth st;
+    st.allocate_voices(DEFAULT_POLYPHONY);
+    std::vector<NoteEvent> events;
+    Patch patch;
+    if (!load_patch(st, argv[1], &patch) || !load_notes(events, argv[2]))
+        return 1;
+    std::string error;
+    if (!patch.nodes.empty() && !st.publish_patch(patch, &error)) {
+        fprintf(stderr, "%s: %s\n", argv[1], error.c_str());
+        return 1;
+    }
+    WavetableCache tables;
+    for (int o = 0; o < OSC_COUNT; o++)
+        st.publish_table(o, tables.get_bank(st.oscs[o]->current_waveform, st.oscs[o]->pulse_width));
+
+    // render past the last note off until the longest release has finished
+    float release = 0.0f;
+    for (auto* osc : st.oscs)
+        release = std::max(release, osc->env.release_time);
+    // and the patch envelopes and a few repeats of its delays
+    for (const auto& node : patch.nodes) {
+        if (node.kind == NodeKind::envelope)
+            release = std::max(release, node.params[3]);
+        else if (node.kind == NodeKind::effect)
+            release = std::max(release, 4 * node.params[0]);
+    }
+    std::uint64_t end = (events.empty() ? 0 : events.back().sample) + ms_to_samples(release) + 1;
+
+    WavWriter wav;
+    if (!wav.open(argv[3], 2, SAMPLE_RATE)) {
+        fprintf(stderr, "Could not open %s for writing\n", argv[3]);
+        return 1;
+    }
+
+    static float buffer[2 * MAX_BLOCK_SIZE];
+    auto started = std::chrono::steady_clock::now();
+    std::size_t next = 0;
+    while (st.now() < end) {
+        // apply every event due now, then render up to the next one
+        for (; next < events.size() && events[next].sample <= st.now(); ++next) {
+            if (events[next].on)
+                st.note_on(events[next].note);
+            else
+                st.note_off(events[next].note);
+        }
+        std::uint64_t until = (next < events.size()) ? std::min(events[next].sample, end) : end;
+        unsigned long frames = (unsigned long)std::min<std::uint64_t>(until - st.now(), MAX_BLOCK_SIZE);
+        // counters for the threads that have registered since, opened here rather than by them
+        if (perf_enabled())
+            perf_open_threads();
+        st.render(buffer, frames);
+        if (!wav.write(buffer, frames)) {
+            fprintf(stderr, "Write to %s failed\n", argv[3]);
+            return 1;
+        }
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - started;
+
+    if (!wav.close()) {
+        fprintf(stderr, "Write to %s failed\n", argv[3]);
+        return 1;
+    }
+    double seconds = (double)end / SAMPLE_RATE;
+    printf("rendered %.2f s to %s\n", seconds, argv[3]);
+    printf("render speed: %.0fx\n", seconds / std::max(elapsed.count(), 1e-9));
+    const MemoryStats mem = st.memory();
+    printf("memory: %zu KB arena, voices %zu/%zu, events %zu/%zu, scratch %zu/%zu bytes, %zu misses\n",
+        mem.arena_bytes / 1024, mem.voices_peak, mem.voice_slots, mem.events_peak, mem.events,
+        mem.scratch_peak, mem.scratch_bytes, mem.misses);
+    if (perf_enabled())
+        perf_report(stdout, perf_stats());
+    // with the realtime checker built in, a render that blocked fails, so CI can run it as a test
+    if (rt_check_total() > 0)
+        return 1;
+    return 0;
+}
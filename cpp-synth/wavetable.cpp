@@ -1,73 +1,179 @@
 #include <algorithm>
+#include "builtin_tables.h"
 #include "wavetable.h"
 
-float Oscillator::interpolate_at(float idx) {
+float Wavetable::interpolate_at(float idx) const {
     float wl, fl;
     fl = std::modf(idx, &wl);
-    return std::lerp(table[(int)wl % TABLE_SIZE], table[(int)(wl + 1) % TABLE_SIZE], fl);
+    return std::lerp(data[(int)wl % TABLE_SIZE], data[(int)(wl + 1) % TABLE_SIZE], fl);
 }
 
-float Oscillator::interpolate_right() {
-    float wl, fl;
-    fl = std::modf(right_phase, &wl);
-    return std::lerp(table[(int)wl % TABLE_SIZE], table[(int)(wl + 1) % TABLE_SIZE], fl);
+const WavetableBank* silent_bank() {
+    static const WavetableBank silence = [] {
+        WavetableBank bank;
+        auto table = std::make_shared<const Wavetable>();
+        for (auto& level : bank.levels)
+            level = table;
+        return bank;
+    }();
+    return &silence;
 }
 
-float Oscillator::interpolate_left() {
-    float wl, fl;
-    fl = std::modf(left_phase, &wl);
-    return std::lerp(table[(int)wl % TABLE_SIZE], table[(int)(wl + 1) % TABLE_SIZE], fl);
+std::shared_ptr<const Wavetable> make_wavetable(int waveform, float pw) {
+    auto table = std::make_shared<Wavetable>();
+    gen_waveform(table.get(), waveform, pw);
+    resample_fixed(table.get());
+    return table;
 }
 
-void gen_sin_wave(Oscillator& table) {
-    for (int i = 0; i < TABLE_SIZE; i++) 
-        table[i] = (float)std::sin((i / (double)TABLE_SIZE) * M_PI * 2.);
+int mip_level_for(float phase_inc) {
+    int level = 0;
+    while (level < MIP_LEVELS - 1 && phase_inc >= (float)(1 << level))
+        ++level;
+    return level;
 }
 
-void gen_sin_wave(Oscillator* table) {
-    for (int i = 0; i < TABLE_SIZE; i++) 
-        (*table)[i] = (float)std::sin((i / (double)TABLE_SIZE) * M_PI * 2.);
+namespace {
+    // cos and sin of 2 pi i / N
+    template <int N>
+    struct UnitCircle
+    {
+        double c[N]{};
+        double s[N]{};
+        constexpr UnitCircle() {
+            for (int i = 0; i < N; i++) {
+                c[i] = const_cos(2 * std::numbers::pi * i / N);
+                s[i] = const_sin(2 * std::numbers::pi * i / N);
+            }
+        }
+    };
+
+    template <int N>
+    constexpr UnitCircle<N> UNIT_CIRCLE{};
+
+    template <int N>
+    const UnitCircle<N>& unit_circle() {
+        return UNIT_CIRCLE<N>;
+    }
+
+    // sums the series at N evenly spaced points of one cycle
+    template <int N>
+    void sum_series(const Spectrum& spectrum, int harmonics, float* out) {
+        const UnitCircle<N>& uc = unit_circle<N>();
+        double sum[N];
+        std::fill_n(sum, N, spectrum.dc);
+        for (int h = 1; h <= harmonics; h++) {
+            const double a = spectrum.cos_terms[h], b = spectrum.sin_terms[h];
+            if (a == 0 && b == 0)
+                continue;
+            for (int i = 0, idx = 0; i < N; i++) {
+                sum[i] += a * uc.c[idx] + b * uc.s[idx];
+                idx += h;
+                if (idx >= N) idx -= N;
+            }
+        }
+        for (int i = 0; i < N; i++)
+            out[i] = (float)sum[i];
+    }
+}
+
+void analyse(const Wavetable& table, Spectrum* spectrum) {
+    const UnitCircle<TABLE_SIZE>& uc = unit_circle<TABLE_SIZE>();
+    spectrum->dc = 0;
+    for (int i = 0; i < TABLE_SIZE; i++)
+        spectrum->dc += table[i];
+    spectrum->dc /= TABLE_SIZE;
+    for (int h = 1; h < TABLE_SIZE / 2; h++) {
+        double a = 0, b = 0;
+        for (int i = 0, idx = 0; i < TABLE_SIZE; i++) {
+            a += table[i] * uc.c[idx];
+            b += table[i] * uc.s[idx];
+            idx += h;
+            if (idx >= TABLE_SIZE) idx -= TABLE_SIZE;
+        }
+        spectrum->cos_terms[h] = 2. * a / TABLE_SIZE;
+        spectrum->sin_terms[h] = 2. * b / TABLE_SIZE;
+    }
+}
+
+void synthesise(const Spectrum& spectrum, int harmonics, Wavetable* table) {
+    harmonics = std::min(harmonics, TABLE_SIZE / 2 - 1);
+    sum_series<TABLE_SIZE>(spectrum, harmonics, table->data);
+    // the series resamples exactly onto the power of two grid
+    sum_series<FIXED_TABLE_SIZE>(spectrum, harmonics, table->fixed);
+    table->fixed[FIXED_TABLE_SIZE] = table->fixed[0];
+}
+
+// linear resample of data onto the fixed grid, for tables that have no spectrum
+void resample_fixed(Wavetable* table) {
+    for (int i = 0; i < FIXED_TABLE_SIZE; i++)
+        table->fixed[i] = table->interpolate_at((float)i * TABLE_SIZE / FIXED_TABLE_SIZE);
+    table->fixed[FIXED_TABLE_SIZE] = table->fixed[0];
+}
+
+std::uint32_t fixed_phase_inc(float phase_inc) {
+    return (std::uint32_t)((double)phase_inc / TABLE_SIZE * 4294967296.0);
 }
 
-void gen_saw_wave(Oscillator& table) {
+void gen_waveform(Wavetable* table, int waveform, float pw) {
+    switch (waveform)
+    {
+        case 0: gen_saw_wave(table); break;
+        case 1: gen_sin_wave(table); break;
+        case 2: gen_sqr_wave(table, pw); break;
+        case 3: gen_tri_wave(table, pw); break;
+        default: gen_silence(table);
+    }
+}
+
+// the compiled in sine is a single harmonic at every level
+void gen_sin_wave(Wavetable& table) {
+    std::copy_n(builtin_table(1, 0).data, TABLE_SIZE, table.data);
+}
+
+void gen_sin_wave(Wavetable* table) {
+    gen_sin_wave(*table);
+}
+
+void gen_saw_wave(Wavetable& table) {
     for (int i = 0; i < TABLE_SIZE; i++) 
         table[i] = 2 * ((i + TABLE_SIZE / 2) % TABLE_SIZE) / (float)TABLE_SIZE - 1.0f;
 }
 
-void gen_saw_wave(Oscillator* table) {
+void gen_saw_wave(Wavetable* table) {
     for (int i = 0; i < TABLE_SIZE; i++) 
         (*table)[i] = 2 * ((i + TABLE_SIZE / 2) % TABLE_SIZE) / (float)TABLE_SIZE - 1.0f;
 }
 
-void gen_sqr_wave(Oscillator& table, float pw) {
+void gen_sqr_wave(Wavetable& table, float pw) {
     for (int i = 0; i < (int)(TABLE_SIZE * pw); i++) 
         table[i] = 1.0f; 
     for (int i = (int)(TABLE_SIZE * pw); i < TABLE_SIZE; i++) 
         table[i] = -1.0f; 
 }
 
-void gen_sqr_wave(Oscillator* table) {
-    for (int i = 0; i < (int)(TABLE_SIZE * table->pulse_width); i++) 
+void gen_sqr_wave(Wavetable* table, float pw) {
+    for (int i = 0; i < (int)(TABLE_SIZE * pw); i++) 
         (*table)[i] = 1.0f; 
-    for (int i = (int)(TABLE_SIZE * table->pulse_width); i < TABLE_SIZE; i++) 
+    for (int i = (int)(TABLE_SIZE * pw); i < TABLE_SIZE; i++) 
         (*table)[i] = -1.0f; 
 }
 
-void gen_tri_wave(Oscillator& table, float pw) {
+void gen_tri_wave(Wavetable& table, float pw) {
     for (int i = 0; i < (int)(TABLE_SIZE * pw); i++) 
         table[i] = 2.0*i / TABLE_SIZE * pw - 1;
     for (int i = (int)(TABLE_SIZE * pw); i < TABLE_SIZE; i++) 
         table[i] = -2.0*(i-TABLE_SIZE)/(TABLE_SIZE-pw*TABLE_SIZE);
 }
 
-void gen_tri_wave(Oscillator* table, float pw) {
-    for (int i = 0; i < (int)(TABLE_SIZE * table->pulse_width); i++)
+void gen_tri_wave(Wavetable* table, float pw) {
+    for (int i = 0; i < (int)(TABLE_SIZE * pw); i++)
         (*table)[i] = 2.0 * i / (TABLE_SIZE * pw) - 1;
-    for (int i = (int)(TABLE_SIZE * table->pulse_width); i < TABLE_SIZE; i++)
+    for (int i = (int)(TABLE_SIZE * pw); i < TABLE_SIZE; i++)
         (*table)[i] = -2.0 * (i - TABLE_SIZE) / (TABLE_SIZE - pw * TABLE_SIZE) - 1;
 }
 
-void gen_silence(Oscillator* table)
+void gen_silence(Wavetable* table)
 {
     for (int i = 0; i < TABLE_SIZE; i++) 
         (*table)[i] = 0;
@@ -81,57 +187,83 @@ float half_f_add_one(float amp) {
     return 0.5f * amp + 1;
 }
 
-inline std::chrono::milliseconds get_time()
+std::uint64_t ms_to_samples(float ms)
 {
-    return std::chrono::duration_cast<std::chrono::milliseconds>(
-        std::chrono::system_clock::now().time_since_epoch());
+    return (std::uint64_t)(ms * (SAMPLE_RATE / 1000.0f));
 }
 
-float ADSR::get_amp(ms sample)
+// phase increment in table samples per output sample for a midi note
+float note_phase_inc(int note)
 {
-    float out_amp = 0;
-    ms life = get_time() - on_time;
-    auto lifec = life.count();
-    if (note_on)
-    {
-        if (lifec <= attack_time)
-        {
-            out_amp = (lifec / attack_time) * 1.0f;
-        }
-        else if (lifec > attack_time && lifec <= (attack_time + decay_time))
-        {
-            out_amp = ((lifec - attack_time) / decay_time) * (sustain_amp - 1.0f) + 1.0f;
-        }
-        else if (lifec > (attack_time + decay_time))
-        {
-            out_amp = sustain_amp;
-        }
-    }
-    else
+    return 440.0f * std::pow(2.0f, (note - 69) / 12.0f) * TABLE_SIZE / SAMPLE_RATE;
+}
+
+float Envelope::get_amp(const ADSR& adsr, std::uint64_t sample)
+{
+    // stamps can be ahead of the sample being rendered, that part of the block is still the previous stage
+    std::uint64_t life = (sample > stage_start) ? sample - stage_start : 0;
+    std::uint64_t length;
+    switch (stage)
     {
-        out_amp = ((sample - off_time).count() / release_time) * (0.0f - keyoff_amp) + keyoff_amp;
+        case Stage::attack:
+            length = ms_to_samples(adsr.attack_time);
+            if (life < length)
+            {
+                level = (float)life / length;
+                break;
+            }
+            stage = Stage::decay;
+            stage_start += length;
+            life -= length;
+            [[fallthrough]];
+        case Stage::decay:
+            length = ms_to_samples(adsr.decay_time);
+            if (life < length)
+            {
+                level = ((float)life / length) * (adsr.sustain_amp - 1.0f) + 1.0f;
+                break;
+            }
+            stage = Stage::sustain;
+            stage_start += length;
+            [[fallthrough]];
+        case Stage::sustain:
+            level = adsr.sustain_amp;
+            break;
+        case Stage::release:
+            length = ms_to_samples(adsr.release_time);
+            if (life < length)
+            {
+                level = ((float)life / length) * (0.0f - keyoff_amp) + keyoff_amp;
+                break;
+            }
+            stage = Stage::idle;
+            [[fallthrough]];
+        case Stage::idle:
+            level = 0.0f;
+            break;
     }
-    if (out_amp <= 0.0001)
+    if (level <= 0.0001f)
     {
-        out_amp = 0.0;
+        level = 0.0f;
     }
-    return out_amp;
+    return level;
 }
 
-void ADSR::key_on(ms time)
+void Envelope::key_on(std::uint64_t sample)
 {
-    if (!lock)
+    if (!note_on())
     {
-        note_on = true;
-        on_time = get_time();
-        lock = true;
+        stage = Stage::attack;
+        stage_start = sample;
     }
-
 }
 
-void ADSR::key_off(ms time)
+void Envelope::key_off(const ADSR& adsr, std::uint64_t sample)
 {
-    note_on = false;
-    off_time = get_time();
-    lock = false;
-}
\ No newline at end of file
+    if (note_on())
+    {
+        keyoff_amp = get_amp(adsr, sample);
+        stage = Stage::release;
+        stage_start = sample;
+    }
+}
@@ -1,63 +1,121 @@
 #pragma once
+#include <algorithm>
 #include <atomic>
 #include <cmath>
 #include <cstddef>
+#include <cstdint>
 #include <iostream>
-#include <chrono>
+#include <memory>
 constexpr auto TABLE_SIZE = (872);
+constexpr auto SAMPLE_RATE = 48000;
+// longest block rendered in one go, longer requests are split
+constexpr auto MAX_BLOCK_SIZE = 512;
+// power of two copy of every table for the fixed-point kernel, the phase is a 32-bit fraction of a cycle
+constexpr auto FIXED_TABLE_BITS = 10;
+constexpr auto FIXED_TABLE_SIZE = 1 << FIXED_TABLE_BITS;
+constexpr auto FIXED_FRAC_BITS = 32 - FIXED_TABLE_BITS;
+// band-limited copies per octave of phase increment, level 0 holds every harmonic the table can
+constexpr auto MIP_LEVELS = 10;
 #ifndef M_PI
 #define M_PI  (3.14159265)
 #endif
 
 
 
+// envelope settings, times are in milliseconds
 struct ADSR
 {
-    using ms = std::chrono::milliseconds;
     float     attack_time   = 0.0f;
     float     decay_time    = 0.0f;
     float     release_time  = 0.01f;
     float     sustain_amp   = 1.0f;
-    float     keyoff_amp    = 0.0f;
-    ms        on_time       = ms(0);
-    ms        off_time      = ms(0);
-    bool      note_on       = false;
-    bool      lock          = false;
-    float     get_amp(ms);
-    void      key_on(ms time);
-    void      key_off(ms time);
 };
 
+// per-voice envelope state, runs on the sample clock of the stream
+struct Envelope
+{
+    enum class Stage { idle, attack, decay, sustain, release };
+    Stage         stage         = Stage::idle;
+    std::uint64_t stage_start   = 0;
+    float         keyoff_amp    = 0.0f;
+    float         level         = 0.0f;
+    float         get_amp(const ADSR& adsr, std::uint64_t sample);
+    void          key_on(std::uint64_t sample);
+    void          key_off(const ADSR& adsr, std::uint64_t sample);
+    bool          note_on() const { return stage != Stage::idle && stage != Stage::release; }
+    bool          active() const  { return stage != Stage::idle; }
+};
+
+struct WavetableBank;
+const WavetableBank* silent_bank();
+
+// one cycle of a waveform, never written again once it has been published to the audio thread
+struct Wavetable
+{
+    float  data[TABLE_SIZE]{ 0 };
+    // data resampled to FIXED_TABLE_SIZE, with the first sample repeated at the end
+    float  fixed[FIXED_TABLE_SIZE + 1]{ 0 };
+    float& operator[](int i) { return data[i]; }
+    float  operator[](int i) const { return data[i]; }
+    float  interpolate_at(float idx) const;
+    float  interpolate_fixed(std::uint32_t phase) const
+    {
+        const std::uint32_t idx = phase >> FIXED_FRAC_BITS;
+        const float frac = (float)(phase & ((1u << FIXED_FRAC_BITS) - 1)) * (1.0f / (1u << FIXED_FRAC_BITS));
+        return fixed[idx] + frac * (fixed[idx + 1] - fixed[idx]);
+    }
+};
+
+// the mip levels of one waveform, level k stays below nyquist up to a phase increment of 2^k
+struct WavetableBank
+{
+    std::shared_ptr<const Wavetable> levels[MIP_LEVELS];
+    const Wavetable& level(int mip_level) const { return *levels[mip_level]; }
+};
+
+// fourier series of a table, harmonics 1 to TABLE_SIZE / 2 - 1
+struct Spectrum
+{
+    double dc = 0;
+    double cos_terms[TABLE_SIZE / 2]{ 0 };
+    double sin_terms[TABLE_SIZE / 2]{ 0 };
+};
+
+// shared settings of one oscillator, voices hold the phases and envelope state
 struct Oscillator
 {
-    ADSR   env;
-    float  amp              = 1.0f;
-    char   label            = ' ';
-    float  left_phase       = 0;
-    float  right_phase      = 0;
-    float  left_phase_inc   = 1;
-    float  right_phase_inc  = 1;
-    int    current_note     = 1;
-    int    current_waveform = 2;
-    float  pulse_width      = 0.5f;
-    float  table[TABLE_SIZE]{ 0 };
-    float& operator[](int i) { return table[i]; }
-    float  interpolate_at(float idx);
-    float  interpolate_left();
-    float  interpolate_right();
+    ADSR                 env;
+    float                amp              = 1.0f;
+    char                 label            = ' ';
+    int                  current_waveform = 2;
+    float                pulse_width      = 0.5f;
+    const WavetableBank* bank             = silent_bank();
 };
 
-void gen_sin_wave(Oscillator& table);
-void gen_sin_wave(Oscillator* table);
-void gen_saw_wave(Oscillator& table);
-void gen_saw_wave(Oscillator* table);
-void gen_sqr_wave(Oscillator& table, float pw);
-void gen_sqr_wave(Oscillator* table);
-void gen_tri_wave(Oscillator& table, float pw);
-void gen_tri_wave(Oscillator* table, float pw);
-void gen_silence(Oscillator* table);
-
-inline std::chrono::milliseconds get_time();
+// waveform names in current_waveform order
+constexpr const char* WAVEFORM_NAMES[] = { "Sawtooth", "Sine", "Square", "Triangle", "Silence" };
+
+std::shared_ptr<const Wavetable> make_wavetable(int waveform, float pw);
+int  mip_level_for(float phase_inc);
+// harmonics kept at a mip level, the top of level 0 is the nyquist of the table
+constexpr int mip_harmonics(int mip_level) { return std::max((TABLE_SIZE / 2 - 1) >> mip_level, 1); }
+void analyse(const Wavetable& table, Spectrum* spectrum);
+void synthesise(const Spectrum& spectrum, int harmonics, Wavetable* table);
+void resample_fixed(Wavetable* table);
+std::uint32_t fixed_phase_inc(float phase_inc);
+void gen_waveform(Wavetable* table, int waveform, float pw);
+void gen_sin_wave(Wavetable& table);
+void gen_sin_wave(Wavetable* table);
+void gen_saw_wave(Wavetable& table);
+void gen_saw_wave(Wavetable* table);
+void gen_sqr_wave(Wavetable& table, float pw);
+void gen_sqr_wave(Wavetable* table, float pw);
+void gen_tri_wave(Wavetable& table, float pw);
+void gen_tri_wave(Wavetable* table, float pw);
+void gen_silence(Wavetable* table);
+
+std::uint64_t ms_to_samples(float ms);
+float note_phase_inc(int note);
 float clip(float amp);
 float half_f_add_one(float amp);
 
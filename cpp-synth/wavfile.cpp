@@ -0,0 +1,65 @@
+#include "wavfile.h"
+
+namespace {
+    void put_u16(FILE* f, std::uint16_t v) {
+        unsigned char b[2] = { (unsigned char)v, (unsigned char)(v >> 8) };
+        fwrite(b, 1, 2, f);
+    }
+
+    void put_u32(FILE* f, std::uint32_t v) {
+        unsigned char b[4] = { (unsigned char)v, (unsigned char)(v >> 8), (unsigned char)(v >> 16), (unsigned char)(v >> 24) };
+        fwrite(b, 1, 4, f);
+    }
+}
+
+WavWriter::~WavWriter() {
+    close();
+}
+
+void WavWriter::write_header(std::uint32_t data_bytes) {
+    fwrite("RIFF", 1, 4, file);
+    put_u32(file, 36 + data_bytes);
+    fwrite("WAVEfmt ", 1, 8, file);
+    put_u32(file, 16);
+    put_u16(file, 3);                                   // IEEE float
+    put_u16(file, (std::uint16_t)channels);
+    put_u32(file, (std::uint32_t)sample_rate);
+    put_u32(file, (std::uint32_t)(sample_rate * channels * sizeof(float)));
+    put_u16(file, (std::uint16_t)(channels * sizeof(float)));
+    put_u16(file, 32);
+    fwrite("data", 1, 4, file);
+    put_u32(file, data_bytes);
+}
+
+bool WavWriter::open(const char* path, int channels_, int sample_rate_) {
+    close();
+    file = fopen(path, "wb");
+    if (file == 0)
+        return false;
+    channels = channels_;
+    sample_rate = sample_rate_;
+    frames_written = 0;
+    // sizes are patched in close()
+    write_header(0);
+    return true;
+}
+
+bool WavWriter::write(const float* interleaved, std::size_t frames) {
+    if (file == 0)
+        return false;
+    std::size_t n = fwrite(interleaved, sizeof(float) * channels, frames, file);
+    frames_written += n;
+    return n == frames;
+}
+
+bool WavWriter::close() {
+    if (file == 0)
+        return false;
+    std::uint64_t data_bytes = frames_written * channels * sizeof(float);
+    bool ok = fseek(file, 0, SEEK_SET) == 0;
+    if (ok)
+        write_header((std::uint32_t)data_bytes);
+    ok = (fclose(file) == 0) && ok;
+    file = 0;
+    return ok;
+}
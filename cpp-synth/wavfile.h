@@ -0,0 +1,21 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+// streaming writer for 32-bit float WAV files
+class WavWriter
+{
+private:
+    FILE* file{ 0 };
+    int channels{ 2 };
+    int sample_rate{ 0 };
+    std::uint64_t frames_written{ 0 };
+    void write_header(std::uint32_t data_bytes);
+public:
+    ~WavWriter();
+    bool open(const char* path, int channels, int sample_rate);
+    bool write(const float* interleaved, std::size_t frames);
+    bool close();
+    std::uint64_t frames() const { return frames_written; }
+};